@@ -6,6 +6,15 @@
 #include "ptr.hpp"
 #include <utility>
 #include <tuple>
+#include <numeric>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <stdexcept>
 
 namespace fwd
 {
@@ -74,8 +83,47 @@ namespace fwd
 			(std::get<Count>(table).resize(n), ...);
 		}
 
+		template <size_t... Count>
+		void append(span<Columns const>... rows, std::index_sequence<Count...>)
+		{
+			(std::get<Count>(table).insert(std::get<Count>(table).end(), rows.begin(), rows.end()), ...);
+		}
+
+		template <size_t... Count>
+		void permute(span<size_t const> rows, std::index_sequence<Count...>)
+		{
+			(permute(std::get<Count>(table), rows), ...);
+		}
+
+		template <size_t... Count>
+		void gather(matrix& out, span<size_t const> rows, std::index_sequence<Count...>) const
+		{
+			(gather(std::get<Count>(out.table), std::get<Count>(table), rows), ...);
+		}
+
+		template <class Column>
+		static void gather(vector<Column>& out, vector<Column> const& in, span<size_t const> rows)
+		{
+			out.reserve(out.size() + rows.size());
+			for (auto const row : rows)
+			{
+				out.push_back(in[row]);
+			}
+		}
+
+		template <class Column>
+		static void permute(vector<Column>& that, span<size_t const> rows)
+		{
+			vector<Column> out;
+			gather(out, that, rows);
+			that.swap(out);
+		}
+
 	public:
 
+		template <size_t Column>
+		using value = std::tuple_element_t<Column, std::tuple<Columns...>>;
+
 		auto size() const
 		{
 			auto const sizes = size(index());
@@ -121,6 +169,154 @@ namespace fwd
 		{
 			resize(n, index());
 		}
+
+		template <size_t Column> auto& column()
+		{
+			return std::get<Column>(table);
+		}
+
+		template <size_t Column> auto const& column() const
+		{
+			return std::get<Column>(table);
+		}
+
+		void append(span<Columns const>... rows)
+		// Batch of rows given as one span per column
+		{
+			#ifdef assert
+			assert(((rows.size() == std::get<0>(std::tie(rows...)).size()) and ...));
+			#endif
+			append(rows..., index());
+		}
+
+		template <size_t Column, class Order = std::less<>>
+		auto order(Order by = { }) const
+		// Permutation of rows sorted stably by one column
+		{
+			auto const& that = column<Column>();
+			vector<size_t> rows(that.size());
+			std::iota(rows.begin(), rows.end(), size_t(0));
+			std::stable_sort(rows.begin(), rows.end(), [&](size_t i, size_t j)
+			{
+				return by(that[i], that[j]);
+			});
+			return rows;
+		}
+
+		void permute(span<size_t const> rows)
+		// Reorder every column as listed in rows
+		{
+			permute(rows, index());
+		}
+
+		template <size_t Column, class Order = std::less<>>
+		void sort(Order by = { })
+		// Reorder every column by one of them
+		{
+			auto const rows = order<Column>(by);
+			permute(rows);
+		}
+
+		template <size_t Column, class Predicate>
+		auto select(Predicate p) const
+		// Rows in order whose column value satisfies p
+		{
+			auto const& that = column<Column>();
+			vector<size_t> rows(that.size());
+			size_t n = 0;
+			for (size_t i = 0; i < that.size(); ++i)
+			{
+				// Write always and advance on a match, no branch
+				rows[n] = i;
+				n += p(that[i]) ? 1 : 0;
+			}
+			rows.resize(n);
+			return rows;
+		}
+
+		auto gather(span<size_t const> rows) const
+		// New matrix of the selected rows
+		{
+			matrix out;
+			gather(out, rows, index());
+			return out;
+		}
+
+		template <size_t Column, class Type = value<Column>, class Operation = std::plus<>>
+		Type fold(std::type_identity_t<Type> init = { }, Operation op = { }) const
+		// Reduce a column with four independent lanes
+		{
+			// Promoted results of small types go back to Type
+			auto const step = [&op](Type a, auto const& b)
+			{
+				return static_cast<Type>(op(a, b));
+			};
+
+			auto const& that = column<Column>();
+			auto const data = that.data();
+			auto const size = that.size();
+			if (size < 4)
+			{
+				return std::accumulate(data, data + size, init, step);
+			}
+
+			Type lane[4] =
+			{
+				step(init, data[0]),
+				static_cast<Type>(data[1]),
+				static_cast<Type>(data[2]),
+				static_cast<Type>(data[3]),
+			};
+			size_t i = 4;
+			for (; i + 4 <= size; i += 4)
+			{
+				lane[0] = step(lane[0], data[i + 0]);
+				lane[1] = step(lane[1], data[i + 1]);
+				lane[2] = step(lane[2], data[i + 2]);
+				lane[3] = step(lane[3], data[i + 3]);
+			}
+			for (; i < size; ++i)
+			{
+				lane[0] = step(lane[0], data[i]);
+			}
+			return step(step(lane[0], lane[1]), step(lane[2], lane[3]));
+		}
+
+		template <size_t Column, class Type = value<Column>, class Operation = std::plus<>>
+		Type fold(span<size_t const> rows, std::type_identity_t<Type> init = { }, Operation op = { }) const
+		// Reduce a column over selected rows
+		{
+			auto const& that = column<Column>();
+			Type sum = init;
+			for (auto const row : rows)
+			{
+				sum = static_cast<Type>(op(sum, that[row]));
+			}
+			return sum;
+		}
+
+		template <size_t Column, class Type = value<Column>> auto sum() const
+		{
+			return fold<Column, Type>();
+		}
+
+		template <size_t Column> auto min() const
+		{
+			#ifdef assert
+			assert(not column<Column>().empty());
+			#endif
+			auto const& that = column<Column>();
+			return fold<Column>(that.front(), [](auto a, auto b) { return b < a ? b : a; });
+		}
+
+		template <size_t Column> auto max() const
+		{
+			#ifdef assert
+			assert(not column<Column>().empty());
+			#endif
+			auto const& that = column<Column>();
+			return fold<Column>(that.front(), [](auto a, auto b) { return a < b ? b : a; });
+		}
 	};
 
 	//
@@ -137,7 +333,7 @@ namespace fwd
 	<
 		class Node, template <class> class Alloc = allocator
 	>
-	using graph = std::vector<pair<Node>, Alloc<Node>>;
+	using graph = std::vector<pair<Node>, Alloc<pair<Node>>>;
 
 	template
 	<
@@ -145,6 +341,392 @@ namespace fwd
 	>
 	using group = std::map<pair<Node>, Node, Order<pair<Node>>, Alloc<std::pair<const pair<Node>, Node>>>;
 
+	template <class Function>
+	void parallel(size_t size, Function f, unsigned threads = 0)
+	// Split [0, size) into chunks run on up to threads workers
+	{
+		constexpr size_t grain = 1 << 12;
+		if (0 == threads)
+		{
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		auto const chunks = std::min<size_t>(threads, (size + grain - 1) / grain);
+		if (chunks < 2)
+		{
+			f(size_t(0), size);
+			return;
+		}
+
+		auto const step = (size + chunks - 1) / chunks;
+		vector<std::thread> pool;
+		for (size_t begin = step; begin < size; begin += step)
+		{
+			pool.emplace_back(f, begin, std::min(size, begin + step));
+		}
+		f(size_t(0), step);
+		for (auto& thread : pool)
+		{
+			thread.join();
+		}
+	}
+
+	template
+	<
+		class Node, template <class> class Alloc = allocator, template <class> class Order = order
+	>
+	class sparse
+	// Immutable graph in compressed sparse row form
+	{
+	public:
+
+		using size_type = size_t;
+		static constexpr auto none = ~size_type(0);
+
+	private:
+
+		using arc = std::pair<size_type, size_type>;
+
+		vector<Node, Alloc> nodes;
+		// Distinct nodes in order, position is the vertex
+		vector<size_type, Alloc> offset;
+		// Row of vertex v is [offset[v], offset[v + 1])
+		vector<size_type, Alloc> target;
+		// Heads of all arcs grouped by tail
+
+		void insert(Node const& node)
+		{
+			nodes.push_back(node);
+		}
+
+		void unique()
+		{
+			static Order<Node> const less;
+			std::sort(nodes.begin(), nodes.end(), less);
+			nodes.erase(std::unique(nodes.begin(), nodes.end(), [](auto const& a, auto const& b)
+			{
+				return not less(a, b) and not less(b, a);
+			}),
+			nodes.end());
+		}
+
+		void build(vector<arc> arcs)
+		// Counting sort arcs into rows without duplicates
+		{
+			std::sort(arcs.begin(), arcs.end());
+			arcs.erase(std::unique(arcs.begin(), arcs.end()), arcs.end());
+
+			offset.assign(nodes.size() + 1, 0);
+			target.resize(arcs.size());
+			for (size_type n = 0; n < arcs.size(); ++n)
+			{
+				++offset[arcs[n].first + 1];
+				target[n] = arcs[n].second;
+			}
+			std::partial_sum(offset.begin(), offset.end(), offset.begin());
+		}
+
+	public:
+
+		sparse() : offset(1, 0)
+		{ }
+
+		explicit sparse(span<pair<Node> const> list)
+		// Arcs as in fwd::graph
+		{
+			for (auto const& [from, to] : list)
+			{
+				insert(from);
+				insert(to);
+			}
+			unique();
+
+			vector<arc> arcs;
+			arcs.reserve(list.size());
+			for (auto const& [from, to] : list)
+			{
+				arcs.emplace_back(find(from), find(to));
+			}
+			build(std::move(arcs));
+		}
+
+		explicit sparse(span<edges<Node> const> list)
+		// Adjacency lists as in fwd::edges, nodes without arcs kept
+		{
+			size_type size = 0;
+			for (auto const& [from, to] : list)
+			{
+				insert(from);
+				for (auto const& node : to)
+				{
+					insert(node);
+				}
+				size += to.size();
+			}
+			unique();
+
+			vector<arc> arcs;
+			arcs.reserve(size);
+			for (auto const& [from, to] : list)
+			{
+				auto const tail = find(from);
+				for (auto const& node : to)
+				{
+					arcs.emplace_back(tail, find(node));
+				}
+			}
+			build(std::move(arcs));
+		}
+
+		explicit sparse(group<Node, Alloc, Order> const& map)
+		// Arcs are the keys of fwd::group
+		{
+			for (auto const& [key, value] : map)
+			{
+				insert(key.first);
+				insert(key.second);
+			}
+			unique();
+
+			vector<arc> arcs;
+			arcs.reserve(map.size());
+			for (auto const& [key, value] : map)
+			{
+				arcs.emplace_back(find(key.first), find(key.second));
+			}
+			build(std::move(arcs));
+		}
+
+		bool empty() const { return nodes.empty(); }
+
+		auto size() const { return nodes.size(); }
+
+		auto arcs() const { return target.size(); }
+
+		auto const& at(size_type v) const { return nodes.at(v); }
+
+		size_type find(Node const& node) const
+		// Vertex of node or none
+		{
+			static Order<Node> const less;
+			auto const it = std::lower_bound(nodes.begin(), nodes.end(), node, less);
+			if (nodes.end() == it or less(node, *it))
+			{
+				return none;
+			}
+			return static_cast<size_type>(it - nodes.begin());
+		}
+
+		span<size_type const> next(size_type v) const
+		// Heads of arcs leaving v
+		{
+			#ifdef assert
+			assert(v < size());
+			#endif
+			return { target.data() + offset[v], target.data() + offset[v + 1] };
+		}
+
+		sparse reverse() const
+		// Same nodes with every arc turned around
+		{
+			sparse that;
+			that.nodes = nodes;
+			vector<arc> arcs;
+			arcs.reserve(target.size());
+			for (size_type v = 0; v < size(); ++v)
+			{
+				for (auto const w : next(v))
+				{
+					arcs.emplace_back(w, v);
+				}
+			}
+			that.build(std::move(arcs));
+			return that;
+		}
+
+		vector<size_type, Alloc> breadth(size_type root, unsigned threads = 0) const
+		// Distance of each vertex from root or none, a level at a time
+		{
+			vector<size_type, Alloc> level(size(), none);
+			if (root >= size())
+			{
+				return level;
+			}
+
+			level[root] = 0;
+			vector<size_type, Alloc> frontier { root }, after;
+			std::mutex lock;
+			for (size_type depth = 1; not frontier.empty(); ++depth)
+			{
+				after.clear();
+				parallel(frontier.size(), [&](size_t begin, size_t end)
+				{
+					vector<size_type, Alloc> found;
+					for (auto n = begin; n < end; ++n)
+					{
+						for (auto const w : next(frontier[n]))
+						{
+							auto expected = none;
+							std::atomic_ref<size_type> seen(level[w]);
+							if (seen.load(std::memory_order_relaxed) == none
+							and seen.compare_exchange_strong(expected, depth, std::memory_order_relaxed))
+							{
+								found.push_back(w);
+							}
+						}
+					}
+					std::lock_guard const guard(lock);
+					after.insert(after.end(), found.begin(), found.end());
+				},
+				threads);
+				frontier.swap(after);
+			}
+			return level;
+		}
+
+		vector<size_type, Alloc> depth(size_type root) const
+		// Vertices reachable from root in depth first preorder
+		{
+			vector<size_type, Alloc> out;
+			if (root >= size())
+			{
+				return out;
+			}
+
+			vector<bool> seen(size());
+			vector<arc> stack { { root, offset[root] } };
+			seen[root] = true;
+			out.push_back(root);
+			while (not stack.empty())
+			{
+				auto& [v, n] = stack.back();
+				if (n == offset[v + 1])
+				{
+					stack.pop_back();
+					continue;
+				}
+
+				auto const w = target[n++];
+				if (not seen[w])
+				{
+					seen[w] = true;
+					out.push_back(w);
+					stack.emplace_back(w, offset[w]);
+				}
+			}
+			return out;
+		}
+
+		vector<size_type, Alloc> order(unsigned threads = 0) const
+		// Tails before heads with each level sorted, empty on a cycle
+		{
+			vector<size_type, Alloc> count(size(), 0);
+			parallel(size(), [&](size_t begin, size_t end)
+			{
+				for (auto v = begin; v < end; ++v)
+				{
+					for (auto const w : next(v))
+					{
+						std::atomic_ref<size_type>(count[w]).fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+			},
+			threads);
+
+			vector<size_type, Alloc> out;
+			out.reserve(size());
+			for (size_type v = 0; v < size(); ++v)
+			{
+				if (0 == count[v])
+				{
+					out.push_back(v);
+				}
+			}
+
+			std::mutex lock;
+			for (size_type begin = 0, end = out.size(); begin < end; begin = end, end = out.size())
+			{
+				parallel(end - begin, [&](size_t first, size_t last)
+				{
+					vector<size_type, Alloc> found;
+					for (auto n = begin + first; n < begin + last; ++n)
+					{
+						for (auto const w : next(out[n]))
+						{
+							if (1 == std::atomic_ref<size_type>(count[w]).fetch_sub(1, std::memory_order_acq_rel))
+							{
+								found.push_back(w);
+							}
+						}
+					}
+					std::lock_guard const guard(lock);
+					out.insert(out.end(), found.begin(), found.end());
+				},
+				threads);
+				std::sort(out.begin() + end, out.end());
+			}
+
+			if (out.size() < size())
+			{
+				out.clear();
+			}
+			return out;
+		}
+
+		vector<size_type, Alloc> parts(unsigned threads = 0) const
+		// Least vertex of the weakly connected component of each vertex
+		{
+			vector<size_type, Alloc> root(size());
+			std::iota(root.begin(), root.end(), size_type(0));
+
+			auto const top = [&root](size_type v)
+			{
+				for (;;)
+				{
+					auto const up = std::atomic_ref<size_type>(root[v]).load(std::memory_order_acquire);
+					if (up == v)
+					{
+						return v;
+					}
+					v = up;
+				}
+			};
+
+			parallel(size(), [&](size_t begin, size_t end)
+			{
+				for (auto v = begin; v < end; ++v)
+				{
+					for (auto const w : next(v))
+					{
+						// Hook the greater root under the lesser until both meet
+						for (auto a = top(v), b = top(w); a != b; a = top(a), b = top(b))
+						{
+							if (a < b)
+							{
+								std::swap(a, b);
+							}
+							auto expected = a;
+							if (std::atomic_ref<size_type>(root[a]).compare_exchange_strong(expected, b, std::memory_order_acq_rel))
+							{
+								break;
+							}
+						}
+					}
+				}
+			},
+			threads);
+
+			parallel(size(), [&](size_t begin, size_t end)
+			{
+				for (auto v = begin; v < end; ++v)
+				{
+					std::atomic_ref<size_type>(root[v]).store(top(v), std::memory_order_release);
+				}
+			},
+			threads);
+			return root;
+		}
+	};
+
 	//
 	// Algorithms
 	//
@@ -293,6 +875,305 @@ namespace fwd
 		};
 	}
 
+	//
+	// Small Vector
+	//
+
+	template
+	<
+		class Type, size_t Size, template <class> class Alloc = allocator
+	>
+	class small : Alloc<Type>
+	// Contiguous sequence keeping up to Size elements in place
+	{
+		static_assert(0 < Size);
+
+		using alloc = Alloc<Type>;
+		using traits = std::allocator_traits<alloc>;
+
+		Type* first;
+		size_t count = 0, room = Size;
+		alignas(Type) std::byte buffer[Size * sizeof(Type)];
+
+		Type* local() noexcept
+		{
+			return std::launder(reinterpret_cast<Type*>(buffer));
+		}
+
+		bool spilled() const noexcept
+		{
+			return room > Size;
+		}
+
+		alloc& self() noexcept
+		{
+			return *this;
+		}
+
+		void release() noexcept
+		// Destroy elements and return to the inline buffer
+		{
+			clear();
+			if (spilled())
+			{
+				traits::deallocate(self(), first, room);
+				first = local();
+				room = Size;
+			}
+		}
+
+		template <class... Args>
+		Type& grow(size_t n, Args&&... args)
+		// Move into heap storage for n, constructing a last element first
+		{
+			auto const next = traits::allocate(self(), n);
+			if constexpr (0 < sizeof...(Args))
+			{
+				// Arguments may refer to an element about to move
+				traits::construct(self(), next + count, std::forward<Args>(args)...);
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				traits::construct(self(), next + i, std::move_if_noexcept(first[i]));
+				traits::destroy(self(), first + i);
+			}
+			if (spilled())
+			{
+				traits::deallocate(self(), first, room);
+			}
+			first = next;
+			room = n;
+			return first[count];
+		}
+
+		void take(small& that) noexcept
+		// Steal the heap storage or move elements out of the buffer
+		{
+			if (that.spilled())
+			{
+				first = std::exchange(that.first, that.local());
+				room = std::exchange(that.room, Size);
+				count = std::exchange(that.count, 0);
+			}
+			else
+			{
+				for (auto& it : that)
+				{
+					push_back(std::move(it));
+				}
+				that.clear();
+			}
+		}
+
+	public:
+
+		using value_type = Type;
+		using allocator_type = alloc;
+		using size_type = size_t;
+		using difference_type = std::ptrdiff_t;
+		using reference = Type&;
+		using const_reference = Type const&;
+		using pointer = Type*;
+		using const_pointer = Type const*;
+		using iterator = Type*;
+		using const_iterator = Type const*;
+
+		small() noexcept : first(local())
+		{ }
+
+		small(init<Type> list) : small()
+		{
+			assign(list.begin(), list.end());
+		}
+
+		template <class Iterator>
+		small(Iterator begin, Iterator end) : small()
+		{
+			assign(begin, end);
+		}
+
+		small(span<Type const> list) : small(list.begin(), list.end())
+		{ }
+
+		small(small const& that) : small(that.begin(), that.end())
+		{ }
+
+		small(small&& that) noexcept : small()
+		{
+			take(that);
+		}
+
+		~small()
+		{
+			release();
+		}
+
+		small& operator=(small const& that)
+		{
+			if (this != &that)
+			{
+				assign(that.begin(), that.end());
+			}
+			return *this;
+		}
+
+		small& operator=(small&& that) noexcept
+		{
+			if (this != &that)
+			{
+				release();
+				take(that);
+			}
+			return *this;
+		}
+
+		template <class Iterator>
+		void assign(Iterator begin, Iterator end)
+		{
+			clear();
+			if constexpr (std::forward_iterator<Iterator>)
+			{
+				reserve(static_cast<size_t>(std::distance(begin, end)));
+			}
+			for (; begin != end; ++begin)
+			{
+				emplace_back(*begin);
+			}
+		}
+
+		bool empty() const noexcept { return 0 == count; }
+
+		auto size() const noexcept { return count; }
+
+		auto capacity() const noexcept { return room; }
+
+		auto data() noexcept { return first; }
+
+		auto data() const noexcept { return static_cast<Type const*>(first); }
+
+		auto begin() noexcept { return first; }
+
+		auto begin() const noexcept { return data(); }
+
+		auto end() noexcept { return first + count; }
+
+		auto end() const noexcept { return data() + count; }
+
+		auto& front() { return (*this)[0]; }
+
+		auto& front() const { return (*this)[0]; }
+
+		auto& back() { return (*this)[count - 1]; }
+
+		auto& back() const { return (*this)[count - 1]; }
+
+		auto& operator[](size_t n)
+		{
+			#ifdef assert
+			assert(n < count);
+			#endif
+			return first[n];
+		}
+
+		auto& operator[](size_t n) const
+		{
+			#ifdef assert
+			assert(n < count);
+			#endif
+			return data()[n];
+		}
+
+		auto& at(size_t n)
+		{
+			if (n < count)
+			{
+				return first[n];
+			}
+			throw std::out_of_range("small::at");
+		}
+
+		auto& at(size_t n) const
+		{
+			if (n < count)
+			{
+				return data()[n];
+			}
+			throw std::out_of_range("small::at");
+		}
+
+		void reserve(size_t n)
+		{
+			if (room < n)
+			{
+				(void) grow(n);
+			}
+		}
+
+		template <class... Args>
+		Type& emplace_back(Args&&... args)
+		{
+			if (count < room)
+			{
+				traits::construct(self(), first + count, std::forward<Args>(args)...);
+				return first[count++];
+			}
+			auto& that = grow(2 * room, std::forward<Args>(args)...);
+			++count;
+			return that;
+		}
+
+		void push_back(Type const& that)
+		{
+			(void) emplace_back(that);
+		}
+
+		void push_back(Type&& that)
+		{
+			(void) emplace_back(std::move(that));
+		}
+
+		void pop_back()
+		{
+			#ifdef assert
+			assert(not empty());
+			#endif
+			traits::destroy(self(), first + --count);
+		}
+
+		void resize(size_t n)
+		{
+			reserve(n);
+			while (n < count)
+			{
+				pop_back();
+			}
+			while (count < n)
+			{
+				(void) emplace_back();
+			}
+		}
+
+		void clear() noexcept
+		{
+			while (0 < count)
+			{
+				traits::destroy(self(), first + --count);
+			}
+		}
+
+		bool operator==(small const& that) const
+		{
+			return std::equal(begin(), end(), that.begin(), that.end());
+		}
+	};
+
+	template <size_t Size> struct inplace
+	// Binds Size for template arguments taking a vector
+	{
+		template <class Type, template <class> class Alloc = allocator>
+		using vector = small<Type, Size, Alloc>;
+	};
+
 	//
 	// Container View
 	//
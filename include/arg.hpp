@@ -45,6 +45,10 @@ namespace env::opt
 	// Write options to output string
 	fmt::string::in::ref get(fmt::string::in::ref);
 	// Read options from input string
+	bool watch(view path);
+	// Follow changes to an options file at path
+	std::size_t reload();
+	// Publish changes in watched files, returns keys changed
 };
 
 #endif // file
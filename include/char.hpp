@@ -2,6 +2,8 @@
 #define char_hpp "Universal Character Set"
 
 #include <iomanip>
+#include <algorithm>
+#include <array>
 #include "it.hpp"
 #include "fmt.hpp"
 
@@ -71,6 +73,140 @@ namespace fmt
 	using SA   = fwd::intervals<SA_0, SA_1>;
 	using PUA  = fwd::intervals<PUA_0, PUA_A, PUA_B>;
 
+	// Area lookup
+
+	enum class area : char
+	{
+		ACA, GSA, RTL, PSA, SPA, CJK, CJKV, HSA, SC, PUA, CSA, CHA, ISA, SA, SIP, TIP, UNP, SSP, none
+	};
+
+	struct zone
+	{
+		codepoint begin, end;
+		area id;
+
+		constexpr bool operator<(zone const& that) const
+		{
+			return begin < that.begin;
+		}
+	};
+
+	template <area Id, auto Min, auto Max> constexpr auto zones(fwd::interval<Min, Max> p)
+	{
+		return std::array { zone { p.begin(), p.end(), Id } };
+	}
+
+	template <area Id, class... Parts> constexpr auto zones(fwd::intervals<Parts...>)
+	{
+		return std::array { zone { Parts().begin(), Parts().end(), Id }... };
+	}
+
+	template <class... Zones> constexpr auto concat(Zones... z)
+	{
+		std::array<zone, (std::tuple_size_v<Zones> + ...)> table { };
+		auto it = table.begin();
+		((it = std::copy(z.begin(), z.end(), it)), ...);
+		return table;
+	}
+
+	inline constexpr auto areas = []
+	// Every area of the code space in order
+	{
+		auto table = concat
+		(
+			zones<area::ACA>(ACA()), zones<area::GSA>(GSA()), zones<area::RTL>(RTL()),
+			zones<area::PSA>(PSA()), zones<area::SPA>(SPA()), zones<area::CJK>(CJK()),
+			zones<area::CJKV>(CJKV()), zones<area::HSA>(HSA()), zones<area::SC>(SC()),
+			zones<area::PUA>(PUA()), zones<area::CSA>(CSA()), zones<area::CHA>(CHA()),
+			zones<area::ISA>(ISA()), zones<area::SA>(SA()), zones<area::SIP>(SIP()),
+			zones<area::TIP>(TIP()), zones<area::UNP>(UNP()), zones<area::SSP>(SSP())
+		);
+		std::sort(table.begin(), table.end());
+		return table;
+	}();
+
+	static_assert([]
+	{
+		// Areas tile the code space without gaps, sixteen aligned
+		bool tiled = 0 == areas.front().begin and endpoint == areas.back().end;
+		for (std::size_t i = 1; i < areas.size(); ++i)
+		{
+			tiled = tiled and areas[i - 1].end == areas[i].begin;
+			tiled = tiled and 0 == areas[i].begin % 16;
+		}
+		return tiled;
+	}());
+
+	inline constexpr std::size_t mixed = []
+	// Blocks of 4096 code points where an area begins inside
+	{
+		std::size_t n = 0;
+		codepoint last = -1;
+		for (auto const& z : areas)
+		{
+			if (0 != z.begin % 4096 and last != z.begin / 4096)
+			{
+				last = z.begin / 4096;
+				++n;
+			}
+		}
+		return n;
+	}();
+
+	inline constexpr auto planes = []
+	// Blocks indexed by the top bits, shared when they hold one area
+	{
+		constexpr auto none = static_cast<std::size_t>(area::none);
+		struct
+		{
+			std::array<unsigned char, endpoint / 4096> index;
+			std::array<std::array<area, 256>, none + mixed> block;
+		} table { };
+
+		for (std::size_t i = 0; i < none; ++i)
+		{
+			table.block[i].fill(static_cast<area>(i));
+		}
+
+		auto z = areas.begin();
+		auto next = none;
+		for (codepoint i = 0; i < endpoint / 4096; ++i)
+		{
+			codepoint const begin = i * 4096, end = begin + 4096;
+			while (z->end <= begin) ++z;
+			if (end <= z->end)
+			{
+				table.index[i] = static_cast<unsigned char>(z->id);
+				continue;
+			}
+
+			auto& block = table.block[next];
+			table.index[i] = static_cast<unsigned char>(next++);
+			for (codepoint j = 0; j < 256; ++j)
+			{
+				codepoint const c = begin + j * 16;
+				while (z->end <= c) ++z;
+				block[j] = z->id;
+			}
+		}
+		return table;
+	}();
+
+	constexpr area to_area(codepoint c)
+	// Area of $c in two loads without a branch
+	{
+		bool const in = 0 <= c and c < endpoint;
+		auto const k = in ? c : 0;
+		auto const id = planes.block[planes.index[k / 4096]][k / 16 % 256];
+		return in ? id : area::none;
+	}
+
+	static_assert(area::ACA == to_area('A'));
+	static_assert(area::CJKV == to_area(0x4E2D));
+	static_assert(area::SA == to_area(0x1F600));
+	static_assert(area::PUA == to_area(0x10FFFF));
+	static_assert(area::none == to_area(endpoint));
+
 	//
 	// Character Codes
 	//
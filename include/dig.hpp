@@ -123,6 +123,12 @@ namespace fmt
 	string to_string(double value, int precision);
 	string to_string(long double value, int precision);
 
+	char* to_chars(char* begin, char* end, float value, int precision = -1);
+	char* to_chars(char* begin, char* end, double value, int precision = -1);
+	char* to_chars(char* begin, char* end, long double value, int precision = -1);
+	// Shortest text that reads back when precision is negative, else fixed,
+	// returns the end of the text or null when it does not fit
+
 	long to_long(string::view, int base = 10);
 	long long to_llong(string::view, int base = 10);
 	unsigned long to_ulong(string::view, int base = 10);
@@ -131,6 +137,14 @@ namespace fmt
 	double to_double(string::view);
 	long double to_quad(string::view);
 
+	size_t to_llong(string::view, fwd::vector<long long>&, int base = 10);
+	size_t to_ullong(string::view, fwd::vector<unsigned long long>&, int base = 10);
+	// Append each number between blanks, commas or semicolons, returns how many
+
+	string::ref to_string(fwd::span<long long const>, string::ref, char = ' ', int base = 10);
+	string::ref to_string(fwd::span<unsigned long long const>, string::ref, char = ' ', int base = 10);
+	// Append numbers to a buffer with a separator between them
+
 	template <class N> bool fail(N n)
 	{
 		if constexpr (is_integer<N>)
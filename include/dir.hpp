@@ -15,7 +15,8 @@ namespace fmt::path
 
 namespace fmt::dir
 {
-	string::view::vector split(string::view);
+	string::view::small<> split(string::view);
+	// Folders in place for paths of usual depth
 	string join(string::view::span);
 	string join(string::view::init);
 }
@@ -4,27 +4,185 @@
 #include "tmp.hpp"
 #include "ptr.hpp"
 #include "fmt.hpp"
+#include "algo.hpp"
+#include "shm.hpp"
 #include <tuple>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
 
 namespace doc
 {
 	using path = fmt::diff;
 
-	template <class Type> class instance : fwd::unique
+	template <auto K> static fmt::string::view name = "(none)";
+
+	template <class C> constexpr auto table(const C* = nullptr)
 	{
-		instance() = default;
+		return C::table();
+	}
+
+	template <size_t N, class C> constexpr auto get(const C* = nullptr)
+	{
+		return std::get<N>(table<C>());
+	}
 
+	template <size_t N, class C> fmt::string::view key(const C* = nullptr)
+	{
+		return name<get<N, C>()>;
+	}
+
+	template <size_t N, class C> auto& value(const C* that)
+	{
+		return that->*get<N>(that);
+	}
+
+	template <size_t N, class C> auto& value(C* that)
+	{
+		return that->*get<N>(that);
+	}
+
+	template <size_t N, class C> using member = std::remove_cvref_t<decltype(std::declval<C&>().*get<N, C>())>;
+
+	template <class Type> struct rows
+	// Whole objects side by side
+	{
 		fwd::vector<Type> item;
+
+		auto size() const
+		{
+			return item.size();
+		}
+
+		void push(Type&& type)
+		{
+			item.emplace_back(std::move(type));
+		}
+
+		void move(size_t off)
+		{
+			item.at(off) = std::move(item.back());
+		}
+
+		void pop()
+		{
+			item.pop_back();
+		}
+
+		template <size_t N> auto& value(size_t off)
+		{
+			return doc::value<N>(item.data() + off);
+		}
+	};
+
+	template <class Type> class columns
+	// One column for each member in the table of Type
+	{
+		template <class T, class C> static T member(T C::*);
+
+		template <class... Pointer> static auto layout(std::tuple<Pointer...>)
+		{
+			return fwd::matrix<decltype(member(Pointer()))...>();
+		}
+
+		using matrix = decltype(layout(table<Type>()));
+		using index = std::make_index_sequence<std::tuple_size<decltype(table<Type>())>::value>;
+
+		template <size_t... N> void push(Type&& type, std::index_sequence<N...>)
+		{
+			(void) item.emplace_back(std::move(doc::value<N>(&type))...);
+		}
+
+	public:
+
+		matrix item;
+
+		auto size() const
+		{
+			return item.size();
+		}
+
+		void push(Type&& type)
+		{
+			push(std::move(type), index());
+		}
+
+		void move(size_t off)
+		{
+			item.swap(off, item.size() - 1);
+		}
+
+		void pop()
+		{
+			item.pop_back();
+		}
+
+		template <size_t N> auto& value(size_t off)
+		{
+			return item.template column<N>().at(off);
+		}
+	};
+
+	template <class Type> struct hook
+	// Told of each id opened, closed or set on an instance
+	{
+		virtual ~hook() = default;
+		virtual bool on(size_t) const = 0;
+		virtual void add(int) = 0;
+		virtual void remove(int) = 0;
+	};
+
+	template <class Type, template <class> class Storage = rows> class instance : fwd::unique
+	{
+		instance() = default;
+
+		Storage<Type> item;
 		fwd::vector<size_t> cross;
 		fwd::vector<ptrdiff_t> index;
+		fwd::vector<std::uint64_t> holes, words;
+		// Bit per free index and bit per word of holes with one set
+
+		fwd::vector<hook<Type>*> hooks;
+		// Indexes kept current by open, close and set
+
+		void mark(size_t, bool);
+		size_t lowest() const;
+
+		static constexpr bool whole = std::is_same_v<Storage<Type>, rows<Type>>;
+		// Objects exist as such only when stored by rows
 
 	public:
 
 		static instance& self();
 		int open(Type&&);
 		int close(int);
-		Type* find(int);
-		Type& at(int);
+		Type* find(int) requires whole;
+		Type& at(int) requires whole;
+
+		template <size_t N> auto& value(int);
+		// Member N of the table for an open id
+		template <size_t N, class Value> void set(int, Value&&);
+		// Write member N where indexes on it can see
+
+		void attach(hook<Type>*);
+		void detach(hook<Type>*);
+
+		template <size_t N> auto column() requires (not whole)
+		// Member N of all open objects in no particular order
+		{
+			auto& data = item.item.template column<N>();
+			return std::span(data.data(), data.size());
+		}
+
+		auto ids() const
+		// Open id in each position of a column
+		{
+			return std::span(cross.data(), cross.size());
+		}
 
 		inline auto gap() const
 		{
@@ -32,37 +190,229 @@ namespace doc
 		}
 	};
 
-	template <class Type> auto& access()
+	template <class Type, template <class> class Storage = rows> auto& access()
 	{
-		return instance<Type>::self();
+		return instance<Type, Storage>::self();
 	}
 
-	template <auto K> static fmt::string::view name = "(none)";
-
-	template <class C> constexpr auto table(const C* = nullptr)
+	template <class Type> class concurrent : fwd::unique
+	// Open and close from any thread, find without a lock, free once unpinned
 	{
-		return C::table();
-	}
+		concurrent() = default;
+		~concurrent();
 
-	template <size_t N, class C> constexpr auto get(const C* = nullptr)
+		static constexpr int bits = 20;
+		// Low bits of an id are the slot, high bits its generation
+		static constexpr std::uint32_t mask = (1u << bits) - 1;
+		static constexpr std::uint32_t wrap = (1u << (32 - bits)) - 1;
+		static constexpr std::size_t width = 1 << 10;
+		static constexpr std::size_t batch = 64;
+
+		struct slot
+		{
+			std::atomic<std::uint32_t> tag { 0 };
+			// Twice the generation, plus one while open, within wrap
+			alignas(Type) std::byte data[sizeof (Type)];
+		};
+
+		struct reader
+		{
+			std::atomic<std::uint64_t> seen { 0 };
+			// Epoch when the outermost pin began, zero when none
+			std::size_t depth = 0;
+		};
+
+		std::atomic<slot*> pages[(mask + 1) / width] { };
+		std::atomic<std::uint32_t> next { 0 };
+		std::atomic<std::size_t> count { 0 };
+		std::atomic<std::uint64_t> epoch { 1 };
+
+		using closed = fwd::vector<std::pair<std::uint32_t, std::uint64_t>>;
+		// Slots whose object still lives and the epoch of closing
+
+		struct cache
+		// Slots of one thread so that open and close seldom lock
+		{
+			fwd::vector<std::uint32_t> free;
+			closed dead;
+			// Handed back a batch at a time
+			~cache();
+		};
+
+		std::mutex key;
+		fwd::vector<std::uint32_t> free;
+		// Slots to reuse
+		closed dead;
+		fwd::vector<reader*> readers;
+		std::size_t due = batch;
+		// Dead count at which a hand back next tries to reclaim
+
+		slot* place(std::uint32_t);
+		slot* locate(int) const;
+		cache& local();
+		void refill(fwd::vector<std::uint32_t>&);
+		void hand(cache&);
+		reader& mine();
+		std::size_t reclaim();
+
+	public:
+
+		class hold : fwd::unique
+		// Objects this thread finds stay alive while one exists
+		{
+			reader& that;
+			std::atomic<std::uint64_t> const& epoch;
+
+		public:
+
+			hold(concurrent&);
+			~hold();
+		};
+
+		static concurrent& self();
+		int open(Type);
+		int close(int);
+		Type* find(int) const;
+		Type& at(int) const;
+
+		hold pin()
+		{
+			return hold(*this);
+		}
+
+		std::size_t compact();
+		// Destroy closed objects that no pin may still see
+
+		auto size() const
+		{
+			return count.load(std::memory_order_relaxed);
+		}
+	};
+
+	template <class Type> auto& shared()
 	{
-		return std::get<N>(table<C>());
+		return concurrent<Type>::self();
 	}
 
-	template <size_t N, class C> fmt::string::view key(const C* = nullptr)
+	template <class Type, size_t N, template <class...> class Map, template <class> class Storage>
+	class indexed : public hook<Type>, fwd::unique
+	// Ids of an instance by the value of member N
 	{
-		return name<get<N, C>()>;
-	}
+		using field = member<N, Type>;
 
-	template <size_t N, class C> auto& value(const C* that)
+	public:
+
+		using key = std::conditional_t<std::is_convertible_v<field const&, std::string_view>, std::string, field>;
+
+		indexed();
+		~indexed();
+
+		bool on(size_t) const override;
+		void add(int) override;
+		void remove(int) override;
+
+		fwd::vector<int> find(key const&) const;
+		// Ids with an equal value
+
+	protected:
+
+		instance<Type, Storage>& that;
+		Map<key, int> map;
+		fwd::vector<typename Map<key, int>::iterator> where;
+		// Entry of each id so that remove need not search its equals
+	};
+
+	template <class Type, size_t N, template <class> class Storage = rows>
+	struct hashed : indexed<Type, N, std::unordered_multimap, Storage>
+	// Equality lookup in constant time
+	{ };
+
+	template <class Type, size_t N, template <class> class Storage = rows>
+	struct sorted : indexed<Type, N, std::multimap, Storage>
+	// Equality and range lookup in logarithmic time
 	{
-		return that->*get<N>(that);
-	}
+		using typename indexed<Type, N, std::multimap, Storage>::key;
 
-	template <size_t N, class C> auto& value(C* that)
+		fwd::vector<int> range(key const&, key const&) const;
+		// Ids with a value in the half open range, in order of value
+	};
+
+	template <class Type> class snapshot : fwd::unique
+	// Table of Type saved as fixed rows with text in a blob, mapped read only
 	{
-		return that->*get<N>(that);
-	}
+		struct head
+		{
+			char magic[8];
+			std::uint64_t schema; // names, kinds and sizes of members
+			std::uint64_t count;  // rows
+			std::uint64_t row;    // bytes in a row
+			std::uint64_t text;   // bytes in the blob
+		};
+
+		struct text
+		{
+			std::uint64_t at, size;
+		};
+
+		static constexpr char magic[] = "DOCROWS1";
+
+		using index = std::make_index_sequence<std::tuple_size<decltype(table<Type>())>::value>;
+
+		template <size_t N> static constexpr bool textual = std::is_convertible_v<member<N, Type> const&, fmt::string::view>;
+		template <size_t N> using stored = std::conditional_t<textual<N>, text, member<N, Type>>;
+
+		template <size_t N> static constexpr char kind()
+		// So a member may not change type and keep its size
+		{
+			using T = member<N, Type>;
+			if constexpr (textual<N>) return 't';
+			else if constexpr (std::is_same_v<T, bool>) return 'b';
+			else if constexpr (std::is_floating_point_v<T>) return 'f';
+			else if constexpr (std::is_signed_v<T>) return 'i';
+			else if constexpr (std::is_unsigned_v<T>) return 'u';
+			else return 'o';
+		}
+
+		template <size_t... N> static constexpr auto layout(std::index_sequence<N...>)
+		{
+			// Id first then each member at its own alignment
+			std::array<size_t, sizeof...(N) + 1> at { };
+			size_t end = sizeof (std::uint64_t);
+			((end = (end + alignof(stored<N>) - 1) / alignof(stored<N>) * alignof(stored<N>), at[N] = end, end += sizeof (stored<N>)), ...);
+			at.back() = (end + 7) / 8 * 8;
+			return at;
+		}
+
+		static constexpr auto offset()
+		{
+			return layout(index());
+		}
+
+		static std::uint64_t schema();
+		static bool fits(head const*);
+		// Whether the text of every row lies inside the blob
+
+		env::file::map_ptr map;
+		std::size_t bytes = 0;
+
+		head const* top() const;
+		char const* row(size_t) const;
+
+	public:
+
+		template <template <class> class Storage>
+		static bool save(fmt::string::view, instance<Type, Storage>&);
+		// Write every open object in order of id
+
+		bool open(fmt::string::view);
+		size_t size() const;
+		int id(size_t) const;
+		size_t find(int) const;
+		// Row of an id or npos
+
+		template <size_t N> auto value(size_t) const;
+		// Member N of a row, strings as views into the map
+	};
 }
 
 #endif // file
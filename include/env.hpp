@@ -24,7 +24,10 @@ namespace env
 		bool set(fmt::string::view);
 		bool put(fmt::string::view);
 		bool put(fmt::string::view, fmt::string::view);
-		fmt::string value(fmt::string::view);
+		fmt::string::view value(fmt::string::view);
+		// Expand $NAME, ${NAME} and %NAME% with memo per thread, valid until it sees a change
+		fmt::string::ref expand(fmt::string::view, fmt::string::ref);
+		// Append the expansion of a template to a buffer
 	}
 
 	fmt::string::view::span vars();
@@ -2,6 +2,7 @@
 #define err_hpp "Error Format"
 
 #include "fmt.hpp"
+#include <type_traits>
 
 // Pre condition
 
@@ -56,20 +57,110 @@ namespace sys
 	fmt::string::out::ref out(); // thread-safe buffered output device
 	fmt::string::out::ref put(fmt::string::out::ref); // flush out
 
+	namespace flush
+	{
+		bool start(int fd, unsigned ms = 10); // write out of all threads to fd in the background
+		bool wait(unsigned ms = 1000); // until earlier out is written or time runs out
+		void stop(); // write what is left and join
+	}
+
 	namespace impl
 	{
 		int bug(fmt::string::view, bool);
+
+		struct field
+		// One argument of a deferred message kept as its raw value
+		{
+			enum : char { none, sint, uint, real, chr, addr, text, owned } tag = none;
+			union
+			{
+				long long i;
+				unsigned long long u = 0;
+				double d;
+				void const* p;
+			};
+			fmt::string::view s;
+			fmt::string own;
+
+			template <typename T> static field make(T const& t)
+			{
+				field f;
+				if constexpr (std::is_integral_v<T> and 1 == sizeof (T) and not std::is_same_v<T, bool>)
+				{
+					f.tag = chr;
+					f.u = static_cast<unsigned char>(t);
+				}
+				else
+				if constexpr (std::is_integral_v<T> and std::is_signed_v<T>)
+				{
+					f.tag = sint;
+					f.i = t;
+				}
+				else
+				if constexpr (std::is_integral_v<T>)
+				{
+					f.tag = uint;
+					f.u = t;
+				}
+				else
+				if constexpr (std::is_floating_point_v<T>)
+				{
+					f.tag = real;
+					f.d = t;
+				}
+				else
+				if constexpr (std::is_convertible_v<T const&, fmt::string::view>)
+				{
+					f.tag = text;
+					if constexpr (std::is_pointer_v<T>)
+					{
+						f.s = nullptr == t ? "(null)" : fmt::string::view(t);
+					}
+					else f.s = t;
+				}
+				else
+				if constexpr (std::is_pointer_v<T>)
+				{
+					f.tag = addr;
+					f.p = t;
+				}
+				else // format only what has no raw form
+				{
+					fmt::string::stream ss;
+					ss << t;
+					f.tag = owned;
+					f.own = ss.str();
+				}
+				return f;
+			}
+		};
+
+		int log(fmt::where const&, bool, field const*, size_t);
+		// Append a record to the ring of this thread
+		size_t drain(fmt::string::out::ref);
+		// Format records of every thread, returns how many
 	}
 
 	extern bool debug; // whether to write out
+	extern bool defer; // whether to record values and format on put
 
 	template <typename... T> int warn(fmt::where at, T... t)
 	{
+		if (debug and defer)
+		{
+			impl::field const f[] = { impl::field::make(t)..., { } };
+			return impl::log(at, false, f, sizeof...(T));
+		}
 		return debug ? impl::bug(fmt::err(at, t...), false) : -1;
 	}
 
 	template <typename... T> int err(fmt::where at, T... t)
 	{
+		if (debug and defer)
+		{
+			impl::field const f[] = { impl::field::make(t)..., { } };
+			return impl::log(at, true, f, sizeof...(T));
+		}
 		return debug ? impl::bug(fmt::err(at, t...), true) : -1;
 	}
 }
@@ -48,6 +48,8 @@ namespace fmt
 		using map    = fwd::map<Type, Order, Alloc>;
 		using span   = fwd::span<Type>;
 		using vector = fwd::vector<Type, Alloc>;
+		template <size_t Size = 8>
+		using small  = fwd::small<Type, Size, Alloc>;
 		using graph  = fwd::graph<Type, Alloc>;
 		using group  = fwd::group<Type, Alloc, Order>;
 		using edges  = fwd::edges<Type>;
@@ -2,6 +2,8 @@
 #define ini_hpp "Initial Options"
 
 #include "doc.hpp"
+#include "shm.hpp"
+#include <cstdint>
 
 namespace doc
 {
@@ -15,8 +17,14 @@ namespace doc
 		using out    = string::out;
 		using in     = string::in;
 
-		path::group keys;
+		using packed = std::uint64_t;
+		// Group in high and key in low half
+
+		fwd::vector<packed> names;
 		string::view::vector values;
+		// Entries in order of insertion
+		fwd::vector<path::type> table;
+		// Open addressed positions in entries or -1
 		string::set cache;
 
 		friend in::ref operator>>(in::ref, ref);
@@ -27,11 +35,51 @@ namespace doc
 		static vector split(view);
 		static string join(init);
 
+		std::size_t parse(view);
+		// Entries refer into the buffer so it must outlive them
+
+		static packed pack(path::pair);
+		static path::pair unpack(packed);
+		std::size_t find(path::pair) const;
+		void rehash(std::size_t);
+
 		bool got(path::pair) const;
 		view get(path::pair) const;
 		bool set(path::pair, view);
 		bool put(path::pair, view);
 	};
+
+	struct image : fwd::unique
+	// Compiled form of an ini mapped read only from disk
+	{
+		using string = fmt::string;
+		using view   = string::view;
+		using out    = string::out;
+
+		static string where(view);
+		// Path of the image compiled from a source file
+		static bool make(ini::cref, view);
+		// Compile entries stamped with the time, size and inode of source
+
+		bool open(view);
+		// Map the image when it is still fresh for the source
+		bool got(path::pair) const;
+		view get(path::pair) const;
+		std::size_t find(path::pair) const;
+		// Position of an entry or npos
+		view get(std::size_t) const;
+		std::size_t count() const;
+
+		friend out::ref operator<<(out::ref, image const&);
+
+	private:
+
+		env::file::map_ptr map;
+		std::size_t size = 0;
+
+		std::size_t find(view, view) const;
+		view text(std::uint32_t, std::uint32_t) const;
+	};
 }
 
 #endif // file
@@ -145,12 +145,12 @@ namespace fwd
 
 		template <class N> constexpr bool any(N n) const
 		{
-			return Part::any(n) or Rest::any(n);
+			return Part().any(n) or Rest().any(n);
 		}
 
 		template <class N> constexpr bool all(N n) const
 		{
-			return Part::any(n) and Rest::all(n);
+			return Part().any(n) and Rest().all(n);
 		}
 
 		constexpr auto size() const
@@ -171,8 +171,8 @@ namespace fwd
 
 	template <class Part> struct intervals<Part>
 	{
-		template <class N> constexpr bool any(N digit) { return Part::any(digit); }
-		template <class N> constexpr bool all(N digit) { return Part::any(digit); }
+		template <class N> constexpr bool any(N digit) const { return Part().any(digit); }
+		template <class N> constexpr bool all(N digit) const { return Part().any(digit); }
 	};
 }
 
@@ -7,6 +7,17 @@
 #include "doc.hpp"
 #include "it.hpp"
 #include "dig.hpp"
+#include "sys.hpp"
+#include "pipe.hpp"
+#include "mode.hpp"
+#include <bit>
+#include <new>
+#include <array>
+#include <limits>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 
 namespace doc
 {
@@ -14,27 +25,62 @@ namespace doc
 	using namespace fwd;
 	using namespace fmt;
 
-	template <class Type> instance<Type>& instance<Type>::self()
+	template <class Type, template <class> class Storage>
+	instance<Type, Storage>& instance<Type, Storage>::self()
 	{
 		static instance singleton;
 		return singleton;
 	}
 
-	template <class Type> int instance<Type>::open(Type&& type)
+	template <class Type, template <class> class Storage>
+	void instance<Type, Storage>::mark(size_t pos, bool hole)
 	{
-		// find lowest free index
-		auto pos = index.size();
-		if (gap() > 0)
+		constexpr size_t bits = 64;
+		auto const word = pos / bits;
+		auto const top = word / bits;
+		if (holes.size() <= word)
 		{
-			for (auto count : up_to(pos))
+			holes.resize(word + 1, 0);
+			words.resize(top + 1, 0);
+		}
+
+		auto const bit = uint64_t(1) << (pos % bits);
+		auto const sum = uint64_t(1) << (word % bits);
+		if (hole)
+		{
+			holes.at(word) |= bit;
+			words.at(top) |= sum;
+		}
+		else
+		{
+			holes.at(word) &= ~bit;
+			if (0 == holes.at(word))
 			{
-				if (index.at(count) < 0)
-				{
-					pos = count;
-					break;
-				}
+				words.at(top) &= ~sum;
 			}
 		}
+	}
+
+	template <class Type, template <class> class Storage>
+	size_t instance<Type, Storage>::lowest() const
+	{
+		constexpr size_t bits = 64;
+		for (size_t top = 0; top < words.size(); ++top)
+		{
+			if (auto const sum = words[top]; 0 != sum)
+			{
+				auto const word = top * bits + countr_zero(sum);
+				return word * bits + countr_zero(holes.at(word));
+			}
+		}
+		return index.size();
+	}
+
+	template <class Type, template <class> class Storage>
+	int instance<Type, Storage>::open(Type&& type)
+	{
+		// find lowest free index
+		auto const pos = gap() > 0 ? lowest() : index.size();
 		// allocate a position
 		auto const off = item.size();
 		if (index.size() == pos)
@@ -44,10 +90,15 @@ namespace doc
 		else
 		{
 			index.at(pos) = off;
+			mark(pos, false);
 		}
 		// allocate an item
-		item.emplace_back(type);
+		item.push(move(type));
 		cross.push_back(pos);
+		for (auto const ptr : hooks)
+		{
+			ptr->add(fmt::to_int(pos));
+		}
 
 		#ifdef assert
 		assert(cross.size() == item.size());
@@ -57,55 +108,666 @@ namespace doc
 		return fmt::to_int(pos);
 	}
 
-	template <class Type> int instance<Type>::close(int id)
+	template <class Type, template <class> class Storage>
+	int instance<Type, Storage>::close(int id)
 	{
 		auto const pos = fmt::to_size(id);
 		#ifdef assert
-		assert(find(pos));
+		assert(in_range(index, pos) and -1 < index.at(pos));
 		#endif
 
+		for (auto const ptr : hooks)
+		{
+			ptr->remove(id);
+		}
+
 		auto const off = index.at(pos);
-		item.at(off) = move(item.back());
+		item.move(off);
 		cross.at(off) = cross.back();
 		index.at(cross.back()) = off;
 		index.at(pos) = -1;
-		while (index.back() < 0)
+		mark(pos, true);
+		while (not index.empty() and index.back() < 0)
 		{
+			mark(index.size() - 1, false);
 			index.pop_back();
 		}
 		cross.pop_back();
-		item.pop_back();
+		item.pop();
 
 		#ifdef assert
 		assert(cross.size() == item.size());
-		assert(item.empty() or cross.at(index.at(off)) == to_size(off));
+		assert(item.size() == to_size(off) or index.at(cross.at(off)) == off);
 		#endif
 
 		auto const size = item.size();
 		return fmt::to_int(size);
 	}
 
-	template <class Type> Type* instance<Type>::find(int id)
+	template <class Type, template <class> class Storage>
+	Type* instance<Type, Storage>::find(int id) requires whole
 	{
 		if (auto const pos = fmt::to_size(id); in_range(index, pos))
 		{
-			if (auto const off = index.at(pos); in_range(item, off))
+			if (auto const off = index.at(pos); in_range(cross, off))
 			{
 				#ifdef assert
 				assert(pos == cross.at(off));
 				#endif
-				return item.data() + off;
+				return item.item.data() + off;
 			}
 		}
 		return nullptr;
 	}
 
-	template <class Type> Type& instance<Type>::at(int id)
+	template <class Type, template <class> class Storage>
+	Type& instance<Type, Storage>::at(int id) requires whole
+	{
+		auto const pos = fmt::to_size(id);
+		#ifdef assert
+		assert(cross.at(index.at(pos)) == pos);
+		#endif
+		return item.item.at(index.at(pos));
+	}
+
+	template <class Type, template <class> class Storage>
+	template <size_t N, class Value> void instance<Type, Storage>::set(int id, Value&& next)
+	{
+		for (auto const ptr : hooks)
+		{
+			if (ptr->on(N))
+			{
+				ptr->remove(id);
+			}
+		}
+		value<N>(id) = forward<Value>(next);
+		for (auto const ptr : hooks)
+		{
+			if (ptr->on(N))
+			{
+				ptr->add(id);
+			}
+		}
+	}
+
+	template <class Type, template <class> class Storage>
+	void instance<Type, Storage>::attach(hook<Type>* ptr)
+	{
+		hooks.push_back(ptr);
+		for (auto const pos : cross)
+		{
+			ptr->add(fmt::to_int(pos));
+		}
+	}
+
+	template <class Type, template <class> class Storage>
+	void instance<Type, Storage>::detach(hook<Type>* ptr)
+	{
+		hooks.erase(std::remove(hooks.begin(), hooks.end(), ptr), hooks.end());
+	}
+
+	template <class Type, size_t N, template <class...> class Map, template <class> class Storage>
+	indexed<Type, N, Map, Storage>::indexed() : that(instance<Type, Storage>::self())
+	{
+		that.attach(this);
+	}
+
+	template <class Type, size_t N, template <class...> class Map, template <class> class Storage>
+	indexed<Type, N, Map, Storage>::~indexed()
+	{
+		that.detach(this);
+	}
+
+	template <class Type, size_t N, template <class...> class Map, template <class> class Storage>
+	bool indexed<Type, N, Map, Storage>::on(size_t column) const
+	{
+		return N == column;
+	}
+
+	template <class Type, size_t N, template <class...> class Map, template <class> class Storage>
+	void indexed<Type, N, Map, Storage>::add(int id)
+	{
+		constexpr bool hashed = requires { map.bucket_count(); };
+		size_t buckets = 0;
+		if constexpr (hashed)
+		{
+			buckets = map.bucket_count();
+		}
+
+		auto const it = map.emplace(key(that.template value<N>(id)), id);
+		auto const pos = fmt::to_size(id);
+		if (where.size() <= pos)
+		{
+			where.resize(pos + 1);
+		}
+		where.at(pos) = it;
+
+		if constexpr (hashed)
+		{
+			// A rehash leaves every other iterator stale
+			if (buckets != map.bucket_count())
+			{
+				for (auto next = map.begin(); next != map.end(); ++next)
+				{
+					where.at(fmt::to_size(next->second)) = next;
+				}
+			}
+		}
+	}
+
+	template <class Type, size_t N, template <class...> class Map, template <class> class Storage>
+	void indexed<Type, N, Map, Storage>::remove(int id)
+	{
+		auto const it = where.at(fmt::to_size(id));
+		#ifdef assert
+		assert(id == it->second);
+		#endif
+		map.erase(it);
+	}
+
+	template <class Type, size_t N, template <class...> class Map, template <class> class Storage>
+	fwd::vector<int> indexed<Type, N, Map, Storage>::find(key const& value) const
+	{
+		fwd::vector<int> ids;
+		auto const [begin, end] = map.equal_range(value);
+		for (auto it = begin; it != end; ++it)
+		{
+			ids.push_back(it->second);
+		}
+		return ids;
+	}
+
+	template <class Type, size_t N, template <class> class Storage>
+	fwd::vector<int> sorted<Type, N, Storage>::range(key const& low, key const& high) const
+	{
+		fwd::vector<int> ids;
+		auto const end = this->map.lower_bound(high);
+		for (auto it = this->map.lower_bound(low); it != end; ++it)
+		{
+			ids.push_back(it->second);
+		}
+		return ids;
+	}
+
+	template <class Type> concurrent<Type>& concurrent<Type>::self()
+	{
+		static concurrent singleton;
+		return singleton;
+	}
+
+	template <class Type> concurrent<Type>::~concurrent()
+	{
+		for (auto const& d : dead)
+		{
+			auto const s = place(d.first);
+			std::launder(reinterpret_cast<Type*>(s->data))->~Type();
+		}
+		for (auto& page : pages)
+		{
+			if (auto const ptr = page.load(memory_order_acquire); nullptr != ptr)
+			{
+				for (size_t n = 0; n < width; ++n)
+				{
+					if (ptr[n].tag.load(memory_order_relaxed) & 1)
+					{
+						std::launder(reinterpret_cast<Type*>(ptr[n].data))->~Type();
+					}
+				}
+				delete[] ptr;
+			}
+		}
+	}
+
+	template <class Type> auto concurrent<Type>::place(uint32_t n) -> slot*
+	{
+		// Pages never move once published
+		auto& page = pages[n / width];
+		auto ptr = page.load(memory_order_acquire);
+		if (nullptr == ptr)
+		{
+			auto const fresh = new slot[width];
+			if (page.compare_exchange_strong(ptr, fresh, memory_order_acq_rel))
+			{
+				ptr = fresh;
+			}
+			else delete[] fresh;
+		}
+		return ptr + n % width;
+	}
+
+	template <class Type> auto concurrent<Type>::locate(int id) const -> slot*
+	{
+		if (id < 0)
+		{
+			return nullptr;
+		}
+
+		auto const n = static_cast<uint32_t>(id) & mask;
+		auto const ptr = pages[n / width].load(memory_order_acquire);
+		if (nullptr == ptr)
+		{
+			return nullptr;
+		}
+
+		// Open with the same generation as the id
+		auto const s = ptr + n % width;
+		auto const gen = static_cast<uint32_t>(id) >> bits;
+		if (s->tag.load(memory_order_seq_cst) != 2 * gen + 1)
+		{
+			return nullptr;
+		}
+		return s;
+	}
+
+	template <class Type> concurrent<Type>::cache::~cache()
+	{
+		// Give slots back when the thread ends
+		if (not free.empty() or not dead.empty())
+		{
+			auto& that = concurrent::self();
+			lock_guard const lock(that.key);
+			that.free.insert(that.free.end(), free.begin(), free.end());
+			that.dead.insert(that.dead.end(), dead.begin(), dead.end());
+		}
+	}
+
+	template <class Type> auto concurrent<Type>::local() -> cache&
+	{
+		thread_local cache list;
+		return list;
+	}
+
+	template <class Type> void concurrent<Type>::hand(cache& list)
+	{
+		// With the key held
+		dead.insert(dead.end(), list.dead.begin(), list.dead.end());
+		list.dead.clear();
+		if (due <= dead.size())
+		{
+			(void) reclaim();
+		}
+	}
+
+	template <class Type> auto concurrent<Type>::mine() -> reader&
+	{
+		struct entry : reader
+		{
+			entry()
+			{
+				auto& that = concurrent::self();
+				lock_guard const lock(that.key);
+				that.readers.push_back(this);
+			}
+
+			~entry()
+			{
+				auto& that = concurrent::self();
+				lock_guard const lock(that.key);
+				auto& list = that.readers;
+				list.erase(std::remove(list.begin(), list.end(), this), list.end());
+			}
+		};
+
+		thread_local entry record;
+		return record;
+	}
+
+	template <class Type> concurrent<Type>::hold::hold(concurrent& ptr)
+	: that(ptr.mine()), epoch(ptr.epoch)
+	{
+		// Announce before any find so a close after this waits
+		if (0 == that.depth++)
+		{
+			that.seen.store(epoch.load(memory_order_seq_cst), memory_order_seq_cst);
+		}
+	}
+
+	template <class Type> concurrent<Type>::hold::~hold()
+	{
+		if (0 == --that.depth)
+		{
+			that.seen.store(0, memory_order_release);
+		}
+	}
+
+	template <class Type> size_t concurrent<Type>::reclaim()
+	{
+		// Oldest epoch any pin began in
+		auto low = numeric_limits<uint64_t>::max();
+		for (auto const r : readers)
+		{
+			if (auto const seen = r->seen.load(memory_order_seq_cst); 0 != seen)
+			{
+				low = std::min(low, seen);
+			}
+		}
+
+		// Closed before every pin so none can have found it
+		size_t size = 0;
+		auto const end = std::remove_if(dead.begin(), dead.end(), [&](auto const& d)
+		{
+			if (low <= d.second)
+			{
+				return false;
+			}
+			auto const s = place(d.first);
+			std::launder(reinterpret_cast<Type*>(s->data))->~Type();
+			free.push_back(d.first);
+			++size;
+			return true;
+		});
+		dead.erase(end, dead.end());
+		due = dead.size() + batch;
+		return size;
+	}
+
+	template <class Type> void concurrent<Type>::refill(fwd::vector<uint32_t>& list)
+	{
+		// Reuse compacted slots first
+		{
+			lock_guard const lock(key);
+			auto const n = std::min(batch, free.size());
+			list.insert(list.end(), free.end() - n, free.end());
+			free.resize(free.size() - n);
+		}
+		if (list.empty())
+		{
+			// Stop at capacity so no live slot is handed out twice
+			auto first = next.load(memory_order_relaxed);
+			uint32_t last;
+			do
+			{
+				if (mask < first)
+				{
+					return;
+				}
+				last = std::min<uint32_t>(first + batch, mask + 1);
+			}
+			while (not next.compare_exchange_weak(first, last, memory_order_relaxed));
+
+			for (auto n = last; first < n; --n)
+			{
+				list.push_back(n - 1);
+			}
+		}
+	}
+
+	template <class Type> int concurrent<Type>::open(Type type)
+	{
+		auto& list = local().free;
+		if (list.empty())
+		{
+			refill(list);
+			if (list.empty())
+			{
+				return -1; // full
+			}
+		}
+		auto const n = list.back();
+		list.pop_back();
+
+		auto const s = place(n);
+		new (s->data) Type(std::move(type));
+		auto const tag = (s->tag.load(memory_order_relaxed) + 1) & wrap;
+		s->tag.store(tag, memory_order_release);
+		count.fetch_add(1, memory_order_relaxed);
+
+		auto const gen = tag >> 1;
+		return static_cast<int>((gen << bits) | n);
+	}
+
+	template <class Type> int concurrent<Type>::close(int id)
+	{
+		auto const s = locate(id);
+		if (nullptr == s)
+		{
+			return -1;
+		}
+
+		// Only one thread closes an open slot
+		auto tag = 2 * (static_cast<uint32_t>(id) >> bits) + 1;
+		if (not s->tag.compare_exchange_strong(tag, (tag + 1) & wrap, memory_order_seq_cst))
+		{
+			return -1;
+		}
+
+		// Pins that began from now on cannot find it
+		auto const e = epoch.fetch_add(1, memory_order_seq_cst);
+		auto& list = local();
+		list.dead.emplace_back(static_cast<uint32_t>(id) & mask, e);
+		if (batch <= list.dead.size())
+		{
+			lock_guard const lock(key);
+			hand(list);
+		}
+		auto const size = count.fetch_sub(1, memory_order_relaxed) - 1;
+		return fmt::to_int(size);
+	}
+
+	template <class Type> Type* concurrent<Type>::find(int id) const
+	{
+		auto const s = locate(id);
+		return nullptr == s ? nullptr : std::launder(reinterpret_cast<Type*>(s->data));
+	}
+
+	template <class Type> Type& concurrent<Type>::at(int id) const
+	{
+		auto const ptr = find(id);
+		#ifdef assert
+		assert(nullptr != ptr);
+		#endif
+		return *ptr;
+	}
+
+	template <class Type> size_t concurrent<Type>::compact()
+	{
+		auto& list = local();
+		lock_guard const lock(key);
+		// Slots other threads hold back wait for their batch
+		dead.insert(dead.end(), list.dead.begin(), list.dead.end());
+		list.dead.clear();
+		return reclaim();
+	}
+
+	template <class Type> uint64_t snapshot<Type>::schema()
+	{
+		uint64_t n = 0xCBF29CE484222325;
+		auto const step = [&n](auto const& bytes)
+		{
+			for (unsigned char const c : bytes)
+			{
+				n ^= c;
+				n *= 0x100000001B3;
+			}
+		};
+		[&step]<size_t... N>(index_sequence<N...>)
+		{
+			(step(key<N, Type>()), ...);
+			(step(array { kind<N>() }), ...);
+			(step(std::to_string(sizeof (stored<N>))), ...);
+		}(index());
+		return n;
+	}
+
+	template <class Type>
+	template <template <class> class Storage>
+	bool snapshot<Type>::save(fmt::string::view path, instance<Type, Storage>& that)
+	{
+		auto const ids = that.ids();
+		fwd::vector<int> order(ids.begin(), ids.end());
+		sort(order.begin(), order.end());
+
+		constexpr auto offset = snapshot::offset();
+
+		head h { };
+		memcpy(h.magic, magic, sizeof h.magic);
+		h.schema = schema();
+		h.count = order.size();
+		h.row = offset.back();
+
+		// Rows are copied whole, strings moved aside into the blob
+		fmt::string rows(order.size() * h.row, '\0');
+		fmt::string blob;
+		for (size_t n = 0; n < order.size(); ++n)
+		{
+			auto const base = rows.data() + n * h.row;
+			uint64_t const id = order[n];
+			memcpy(base, &id, sizeof id);
+			[&]<size_t... N>(index_sequence<N...>)
+			{
+				([&]
+				{
+					auto const& field = that.template value<N>(order[n]);
+					if constexpr (textual<N>)
+					{
+						fmt::string::view const u = field;
+						text const t { blob.size(), u.size() };
+						blob.append(u);
+						memcpy(base + offset[N], &t, sizeof t);
+					}
+					else
+					{
+						static_assert(is_trivially_copyable_v<stored<N>>);
+						memcpy(base + offset[N], &field, sizeof field);
+					}
+				}(), ...);
+			}(index());
+		}
+		h.text = blob.size();
+
+		// Replace the old file whole so readers never see a part
+		fmt::string::view const bytes(reinterpret_cast<char const*>(&h), sizeof h);
+		return env::file::replace(path, { bytes, rows, blob });
+	}
+
+	template <class Type> bool snapshot<Type>::open(fmt::string::view path)
+	{
+		map.reset();
+		bytes = 0;
+
+		size_t n = 0;
+		auto ptr = env::file::open_map(path, &n);
+		if (nullptr == ptr or n < sizeof (head))
+		{
+			return failure;
+		}
+
+		// Files from another layout of Type are ignored
+		auto const h = static_cast<head const*>(ptr.get());
+		if (memcmp(h->magic, magic, sizeof h->magic)
+			or h->schema != schema()
+			or h->row != offset().back()
+			or (n - sizeof (head)) / h->row < h->count
+			or n != sizeof (head) + h->count * h->row + h->text
+			or not fits(h))
+		{
+			return failure;
+		}
+
+		map = move(ptr);
+		bytes = n;
+		return success;
+	}
+
+	template <class Type> bool snapshot<Type>::fits(head const* h)
+	{
+		auto const rows = reinterpret_cast<char const*>(h + 1);
+		for (size_t n = 0; n < h->count; ++n)
+		{
+			bool inside = true;
+			auto const base = rows + n * h->row;
+			[&]<size_t... N>(index_sequence<N...>)
+			{
+				([&]
+				{
+					if constexpr (textual<N>)
+					{
+						text t;
+						memcpy(&t, base + offset()[N], sizeof t);
+						inside = inside and t.at <= h->text and t.size <= h->text - t.at;
+					}
+				}(), ...);
+			}(index());
+			if (not inside)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <class Type> auto snapshot<Type>::top() const -> head const*
+	{
+		return static_cast<head const*>(map.get());
+	}
+
+	template <class Type> size_t snapshot<Type>::size() const
+	{
+		return 0 == bytes ? 0 : top()->count;
+	}
+
+	template <class Type> char const* snapshot<Type>::row(size_t n) const
+	{
+		#ifdef assert
+		assert(n < size());
+		#endif
+		return reinterpret_cast<char const*>(top() + 1) + n * top()->row;
+	}
+
+	template <class Type> int snapshot<Type>::id(size_t n) const
+	{
+		uint64_t id;
+		memcpy(&id, row(n), sizeof id);
+		return to_int(id);
+	}
+
+	template <class Type> size_t snapshot<Type>::find(int id) const
+	{
+		// Rows are sorted by id
+		size_t low = 0, high = size();
+		while (low < high)
+		{
+			auto const mid = low + (high - low) / 2;
+			auto const at = this->id(mid);
+			if (at == id)
+			{
+				return mid;
+			}
+			if (at < id)
+			{
+				low = mid + 1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		return npos;
+	}
+
+	template <class Type>
+	template <size_t N> auto snapshot<Type>::value(size_t n) const
+	{
+		stored<N> field;
+		memcpy(&field, row(n) + offset()[N], sizeof field);
+		if constexpr (textual<N>)
+		{
+			auto const blob = reinterpret_cast<char const*>(top() + 1) + top()->count * top()->row;
+			return fmt::string::view(blob + field.at, field.size);
+		}
+		else
+		{
+			return field;
+		}
+	}
+
+	template <class Type, template <class> class Storage>
+	template <size_t N> auto& instance<Type, Storage>::value(int id)
 	{
 		auto const pos = fmt::to_size(id);
 		#ifdef assert
 		assert(cross.at(index.at(pos)) == pos);
 		#endif
-		return item.at(index.at(pos));
+		return item.template value<N>(fmt::to_size(index.at(pos)));
 	}
 }
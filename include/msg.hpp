@@ -8,14 +8,17 @@ namespace doc
 {
 	using function = std::function<void()>;
 	extern template class instance<function>;
+	extern template class concurrent<function>;
 
 	inline auto& socket()
 	{
-		return access<function>();
+		return shared<function>();
 	}
 
 	inline void signal(int id)
 	{
+		// Lives through a close from another thread during the call
+		auto const hold = socket().pin();
 		#ifdef assert
 		assert(socket().find(id));
 		#endif
@@ -2,6 +2,7 @@
 #define opt_hpp "Program Options"
 
 #include "fmt.hpp"
+#include <type_traits>
 
 namespace env::opt
 {
@@ -33,6 +34,42 @@ namespace env::opt
 	bool set(name, float, int digits = 6);
 	float get(pair, float);
 	bool set(pair, float, int digits = 6);
+
+	std::size_t version();
+	// Count of option tables published so far
+
+	template <class Type> class handle
+	// Resolve a key once then read its typed value until the next set
+	{
+		pair key;
+		Type fallback, value;
+		int base;
+		std::size_t stamp;
+
+	public:
+
+		handle(pair entry, Type initial, int radix = 10)
+		: key(entry), fallback(initial), value(initial), base(radix), stamp(fmt::npos)
+		{ }
+
+		Type operator()()
+		// Not shared between threads
+		{
+			if (auto const now = version(); now != stamp)
+			{
+				if constexpr (std::is_same_v<Type, long>)
+				{
+					value = get(key, fallback, base);
+				}
+				else
+				{
+					value = get(key, fallback);
+				}
+				stamp = now;
+			}
+			return value;
+		}
+	};
 };
 
 #endif // file
@@ -10,6 +10,11 @@ namespace env::file
 	using map_ptr = fwd::extern_ptr<void>;
 
 	map_ptr make_map(int, size_t = 0, off_t = 0, mode = rw, size_t* = nullptr);
+
+	map_ptr open_map(fmt::string::view, size_t* = nullptr);
+	// Whole file read only, null when it cannot be mapped, length in the last
+	bool replace(fmt::string::view, fmt::string::view::init);
+	// Write the parts to a temporary renamed over the path so readers never see a part
 }
 
 #endif // file
@@ -1,75 +1,365 @@
 #ifndef sig_hpp
 #define sig_hpp "Signals and Sockets"
 
+#include "ptr.hpp"
 #include <map>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include <string>
 #include <csignal>
+#include <cstddef>
+#include <iterator>
+#include <utility>
 #include <algorithm>
 #include <functional>
+#include <type_traits>
 
 namespace fwd::sig
 {
+	template <class signature, std::size_t size = 4 * sizeof(void*)> class callable;
+
+	template <class result, class... args, std::size_t size> class callable<result(args...), size>
+	// Function object kept in place when small enough, else on the heap
+	{
+		struct table
+		{
+			result (*call)(void*, args&&...);
+			void (*copy)(void const*, void*);
+			void (*move)(void*, void*) noexcept;
+			void (*destroy)(void*) noexcept;
+		};
+
+		template <class type> static constexpr bool local = sizeof(type) <= size
+			and alignof(type) <= alignof(std::max_align_t)
+			and std::is_nothrow_move_constructible_v<type>;
+
+		template <class type> static type* get(void* buf)
+		{
+			if constexpr (local<type>)
+			{
+				return std::launder(static_cast<type*>(buf));
+			}
+			else
+			{
+				return *std::launder(static_cast<type**>(buf));
+			}
+		}
+
+		template <class type> static constexpr table of
+		{
+			[](void* buf, args&&... a) -> result
+			{
+				return std::invoke(*get<type>(buf), std::forward<args>(a)...);
+			},
+			[](void const* from, void* to)
+			{
+				auto const that = get<type>(const_cast<void*>(from));
+				if constexpr (local<type>)
+				{
+					new (to) type(*that);
+				}
+				else
+				{
+					new (to) type*(new type(*that));
+				}
+			},
+			[](void* from, void* to) noexcept
+			{
+				if constexpr (local<type>)
+				{
+					auto const that = get<type>(from);
+					new (to) type(std::move(*that));
+					that->~type();
+				}
+				else
+				{
+					new (to) type*(get<type>(from));
+				}
+			},
+			[](void* buf) noexcept
+			{
+				if constexpr (local<type>)
+				{
+					get<type>(buf)->~type();
+				}
+				else
+				{
+					delete get<type>(buf);
+				}
+			},
+		};
+
+		alignas(std::max_align_t) mutable std::byte buf[size];
+		table const* vt = nullptr;
+
+	public:
+
+		callable() noexcept = default;
+
+		callable(std::nullptr_t) noexcept
+		{ }
+
+		template <class function, class type = std::decay_t<function>,
+			class = std::enable_if_t<not std::is_same_v<type, callable> and std::is_invocable_r_v<result, type&, args...>>>
+		callable(function&& f)
+		{
+			if constexpr (local<type>)
+			{
+				new (buf) type(std::forward<function>(f));
+			}
+			else
+			{
+				new (buf) type*(new type(std::forward<function>(f)));
+			}
+			vt = &of<type>;
+		}
+
+		callable(callable const& that)
+		{
+			if (that.vt)
+			{
+				that.vt->copy(that.buf, buf);
+				vt = that.vt;
+			}
+		}
+
+		callable(callable&& that) noexcept
+		{
+			if (that.vt)
+			{
+				that.vt->move(that.buf, buf);
+				vt = std::exchange(that.vt, nullptr);
+			}
+		}
+
+		~callable()
+		{
+			if (vt)
+			{
+				vt->destroy(buf);
+			}
+		}
+
+		callable& operator=(callable that) noexcept
+		{
+			if (vt)
+			{
+				vt->destroy(buf);
+				vt = nullptr;
+			}
+			if (that.vt)
+			{
+				that.vt->move(that.buf, buf);
+				vt = std::exchange(that.vt, nullptr);
+			}
+			return *this;
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return nullptr != vt;
+		}
+
+		result operator()(args... a) const
+		{
+			#ifdef assert
+			assert(nullptr != vt);
+			#endif
+			return vt->call(buf, std::forward<args>(a)...);
+		}
+	};
+
 	template <class slot, class... args> struct socket : fwd::unique
+	// Slots in order in an immutable array replaced whole on every change
 	{
 		using signature = void(args...);
-		using function = std::function<signature>;
-		using container = std::map<slot, function>;
+		using function = callable<signature>;
+		using value_type = std::pair<slot, function>;
+		using container = std::vector<value_type>;
 		using size_type = typename container::size_type;
 
 		size_type const invalid = ~size_type(0);
 
+		socket() = default;
+
+		~socket()
+		{
+			delete slots.load();
+		}
+
 		auto connect(slot id, function f)
 		{
-			slots.emplace(id, f);
-			return slots.size();
+			arrays garbage; // freed after the lock
+			std::lock_guard const guard(lock);
+			auto const& old = slots.load()->items;
+			auto const at = bound(old, id);
+			if (same(old, at, id))
+			{
+				return old.size();
+			}
+			auto next = std::make_unique<array>();
+			next->items.reserve(old.size() + 1);
+			next->items.insert(next->items.end(), old.begin(), at);
+			next->items.emplace_back(id, std::move(f));
+			next->items.insert(next->items.end(), at, old.end());
+			return exchange(next.release(), garbage);
 		}
 
 		auto disconnect(slot id)
 		{
-			return slots.erase(id);
+			arrays garbage; // freed after the lock
+			std::lock_guard const guard(lock);
+			auto const& old = slots.load()->items;
+			auto const at = bound(old, id);
+			if (not same(old, at, id))
+			{
+				return size_type(0);
+			}
+			auto next = std::make_unique<array>();
+			next->items.reserve(old.size() - 1);
+			next->items.insert(next->items.end(), old.begin(), at);
+			next->items.insert(next->items.end(), std::next(at), old.end());
+			(void) exchange(next.release(), garbage);
+			return size_type(1);
 		}
 
 		auto disconnect()
 		{
-			auto const sz = slots.size();
-			slots.clear();
+			arrays garbage; // freed after the lock
+			std::lock_guard const guard(lock);
+			auto const sz = slots.load()->items.size();
+			(void) exchange(new array, garbage);
 			return sz;
 		}
 
+		size_type size() const
+		{
+			reader const guard(this);
+			return guard.that->items.size();
+		}
+
 		size_type find(slot id) const
 		{
-			auto const it = slots.find(id);
-			auto const begin = slots.begin();
-			auto const end = slots.end();
-			return end != it ? distance(begin, it) : invalid;
+			reader const guard(this);
+			auto const& that = guard.that->items;
+			auto const it = bound(that, id);
+			return same(that, it, id) ? distance(that.begin(), it) : invalid;
 		}
 
-		void raise(args... args) const
+		void raise(args... a) const
 		{
-			raise([=](auto const &pair){ pair.second(args...); });
+			raise([&](auto const &pair){ pair.second(a...); });
 		}
 
-		template <class filter>	void raise(filter &&filter) const
+		template <class filter>	void raise(filter &&f) const
+		// Walk the slots connected when the raise began
 		{
-			for_each(begin(slots), end(slots), filter);
+			reader const guard(this);
+			for_each(begin(guard.that->items), end(guard.that->items), f);
 		}
 
-		template <class filter>	void raise(slot id, filter &&filter) const
+		template <class filter>	void raise(slot id, filter &&f) const
 		{
-			auto const pair = slots.equal_range(id);
-			for_each(pair.first, pair.second, filter);
+			reader const guard(this);
+			auto const& that = guard.that->items;
+			auto const it = bound(that, id);
+			if (same(that, it, id))
+			{
+				f(*it);
+			}
 		}
 
 	protected:
 
-		container slots;
+		struct array
+		{
+			container items;
+			mutable std::atomic<size_type> readers { 0 };
+			// Raises walking these items now
+		};
+
+		using arrays = std::vector<std::unique_ptr<array const>>;
+
+		std::atomic<array const*> slots { new array };
+		// Current array, replaced by writers and never changed in place
+		mutable std::atomic<size_type> entering { 0 };
+		// Readers between loading the current array and pinning it
+		mutable arrays retired;
+		mutable std::mutex lock;
+
+		struct reader
+		// Pins one array so that it outlives this raise
+		{
+			socket const* owner;
+			array const* that;
+
+			reader(socket const* s) : owner(s)
+			{
+				++owner->entering;
+				that = owner->slots.load();
+				++that->readers;
+				--owner->entering;
+			}
+
+			~reader()
+			{
+				// Last out of a replaced array frees it unless a writer is busy
+				if (1 == that->readers.fetch_sub(1) and that != owner->slots.load() and owner->lock.try_lock())
+				{
+					arrays garbage;
+					owner->collect(garbage);
+					owner->lock.unlock();
+				}
+			}
+		};
+
+		static auto bound(container const& that, slot const& id)
+		{
+			return std::lower_bound(that.begin(), that.end(), id, [](value_type const& pair, slot const& key)
+			{
+				return std::less<slot>()(pair.first, key);
+			});
+		}
+
+		static bool same(container const& that, typename container::const_iterator it, slot const& id)
+		{
+			return that.end() != it and not std::less<slot>()(id, it->first);
+		}
+
+		void collect(arrays& garbage) const
+		// Move out, under the lock, replaced arrays that no raise holds
+		{
+			// One may be about to pin an array it loaded
+			if (0 != entering.load())
+			{
+				return;
+			}
+			auto const end = std::partition(retired.begin(), retired.end(), [](auto const& ptr)
+			{
+				return 0 != ptr->readers.load();
+			});
+			std::move(end, retired.end(), std::back_inserter(garbage));
+			retired.erase(end, retired.end());
+		}
+
+		size_type exchange(array const* next, arrays& garbage)
+		// Publish next and hand back old arrays to free once the lock is let go
+		{
+			auto const size = next->items.size();
+			retired.emplace_back(slots.exchange(next));
+			collect(garbage);
+			return size;
+		}
 	};
 
 	template <class... args> class slot
 	{
 	public:
 
-		using socket = socket<slot*, args...>;
+		using socket = sig::socket<slot*, args...>;
 		using function = typename socket::function;
 		using signature = typename socket::signature;
 
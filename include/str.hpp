@@ -14,6 +14,7 @@ namespace fmt
 	view get(view); // O log n
 	name put(view); // O log n
 	name set(view); // O log n
+	diff::vector set(view::span); // O k log n
 
 	string::in::ref get(string::in::ref, char = eol);
 	// read all file lines to cache
@@ -116,6 +116,7 @@ namespace sys
 
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 
 #ifndef O_BINARY
 #define O_BINARY 0L
@@ -185,6 +186,7 @@ namespace sys
 	constexpr auto umask = ::umask;
 	constexpr auto unlink = ::unlink;
 	constexpr auto write = ::write;
+	constexpr auto writev = ::writev;
 
 } // namespace sys
 
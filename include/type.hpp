@@ -6,6 +6,7 @@
 #include "it.hpp"
 #include "utf.hpp"
 #include <locale>
+#include <array>
 
 namespace fmt
 {
@@ -23,6 +24,37 @@ namespace fmt
 		graph  = std::ctype_base::graph,
 		xdigit = std::ctype_base::xdigit;
 
+	inline constexpr auto classes = []
+	// Classic locale masks of each byte
+	{
+		using mask = std::ctype_base::mask;
+		std::array<mask, 256> table { };
+		for (int c = 0; c < 0x80; ++c)
+		{
+			mask m { };
+			auto const set = [&m](bool is, mask x)
+			{
+				if (is) m = static_cast<mask>(m | x);
+			};
+			bool const up = 'A' <= c and c <= 'Z';
+			bool const low = 'a' <= c and c <= 'z';
+			bool const dig = '0' <= c and c <= '9';
+			bool const hex = ('a' <= (c | 0x20) and (c | 0x20) <= 'f');
+			set(c < 0x20 or 0x7F == c, cntrl);
+			set(' ' == c or ('\t' <= c and c <= '\r'), space);
+			set(' ' == c or '\t' == c, blank);
+			set(' ' <= c and c < 0x7F, print);
+			set(up, upper);
+			set(low, lower);
+			set(up or low, alpha);
+			set(dig, digit);
+			set(dig or hex, xdigit);
+			set(' ' < c and c < 0x7F and not (up or low or dig), punct);
+			table[c] = m;
+		}
+		return table;
+	}();
+
 	template <class Char> struct type : std::ctype<Char>
 	{
 		using base = std::ctype<Char>;
@@ -48,7 +80,11 @@ namespace fmt
 		bool check(Char c, mask x = space) const
 		// Check whether code w is an x
 		{
-			return base::is(x, c);
+			if constexpr (std::is_same_v<Char, char>)
+			{
+				return 0 != (classes[static_cast<unsigned char>(c)] & x);
+			}
+			else return base::is(x, c);
 		}
 
 		auto check(view u) const
@@ -59,6 +95,36 @@ namespace fmt
 			return x;
 		}
 
+		static Char const* scan(Char const* it, Char const* end, mask x, bool is)
+		// Next character which is, or is not, an $x without the facet
+		{
+			if constexpr (std::is_same_v<Char, char>)
+			{
+				auto const in = [x](Char c)
+				{
+					return 0 != (classes[static_cast<unsigned char>(c)] & x);
+				};
+				// Short tokens end before a block pays off
+				auto const near = end - it < 16 ? end : it + 16;
+				if (is)
+				{
+					while (it != near and not in(*it)) ++it;
+				}
+				else
+				{
+					while (it != near and in(*it)) ++it;
+				}
+				if (near != it)
+				{
+					return it;
+				}
+			}
+			return end == it ? it : block(it, end, x, is);
+		}
+
+		static Char const* block(Char const* it, Char const* end, mask x, bool is);
+		// Rest of a long scan a block at a time
+
 		template <class Iterator>
 		auto next(Iterator it, Iterator end, mask x = space) const
 		// Next iterator after $it but before $end which is an $x
@@ -78,7 +144,11 @@ namespace fmt
 		auto next(Char const* it, Char const* end, mask x = space) const
 		// Next character after $it but before $end which is an $x
 		{
-			return base::scan_is(x, it, end);
+			if constexpr (std::is_same_v<Char, char>)
+			{
+				return scan(it, end, x, true);
+			}
+			else return base::scan_is(x, it, end);
 		}
 
 		auto next(view u, mask x = space) const
@@ -106,7 +176,11 @@ namespace fmt
 		auto skip(Char const* it, Char const* end, mask x = space) const
 		// Next character after $it but before $end which is not $x
 		{
-			return base::scan_not(x, it, end);
+			if constexpr (std::is_same_v<Char, char>)
+			{
+				return scan(it, end, x, false);
+			}
+			else return base::scan_not(x, it, end);
 		}
 
 		auto skip(view u, mask x = space) const
@@ -351,19 +425,81 @@ namespace fmt
 			return s;
 		}
 
-		static auto split(view u, view v)
-		// Split strings in $u delimited by $v
+		static size_type search(view u, view v, size_type pos);
+		// Position of $v in $u from $pos or npos, without a table
+
+		struct parts
+		// Views in $u between each $v found as the loop asks
 		{
-			vector t;
-			auto const uz = u.size(), vz = v.size();
-			for (auto i = null, j = u.find(v); i < uz; j = u.find(v, i))
+			view u, v;
+
+			struct iterator
 			{
-				auto const k = uz < j ? uz : j;
-				auto const w = u.substr(i, k - i);
-				if (i <= k) t.emplace_back(w);
-				i = k + vz;
+				view u, v;
+				size_type i, k; // part in [i, k)
+
+				bool operator!=(iterator const& it) const
+				{
+					return it.i != i;
+				}
+
+				auto operator*() const
+				{
+					return u.substr(i, k - i);
+				}
+
+				auto& operator++()
+				{
+					i = k + v.size();
+					return find();
+				}
+
+				auto& find()
+				{
+					if (u.size() <= i)
+					{
+						i = k = npos;
+					}
+					else
+					{
+						k = v.empty() ? npos : search(u, v, i);
+						k = std::min(k, u.size());
+					}
+					return *this;
+				}
+			};
+
+			auto begin() const
+			{
+				return iterator { u, v, 0, 0 }.find();
 			}
-			return t;
+
+			auto end() const
+			{
+				return iterator { u, v, npos, npos };
+			}
+
+			bool empty() const
+			{
+				return u.empty();
+			}
+
+			operator vector() const
+			// Where every part is wanted at once
+			{
+				vector t;
+				for (auto const w : *this)
+				{
+					t.emplace_back(w);
+				}
+				return t;
+			}
+		};
+
+		static auto split(view u, view v)
+		// Split strings in $u delimited by $v
+		{
+			return parts { u, v };
 		}
 
 		static auto replace(view u, view v, view w)
@@ -660,16 +796,16 @@ namespace fmt
 	template <>
 	inline string to_string(wstring::view const& w)
 	{
-		string s;
-		for (auto const c : narrow(w)) s += c;
+		string s(w.size() * (2 < sizeof (wchar_t) ? 4 : 3), '\0');
+		s.resize(utf::encode(s.data(), w.data(), w.size()));
 		return s;
 	}
 
 	template <>
 	inline wstring to_wstring(string::view const& s)
 	{
-		wstring w;
-		for (auto const c : widen(s)) w += c;
+		wstring w(s.size(), L'\0');
+		w.resize(utf::decode(w.data(), s.data(), s.size()));
 		return w;
 	}
 
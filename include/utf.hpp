@@ -43,6 +43,21 @@ namespace fmt
 		{
 			return std::wcsrtombs(s, w, n, this);
 		}
+
+		// Bulk UTF-8 without the locale
+
+		static std::size_t check(char const* s, std::size_t n);
+		// Bytes at the front of $s which are well formed
+
+		static std::size_t decode(char32_t* w, char const* s, std::size_t n);
+		static std::size_t decode(char16_t* w, char const* s, std::size_t n);
+		static std::size_t decode(wchar_t* w, char const* s, std::size_t n);
+		// Units written to $w with room for $n, malformed bytes as U+FFFD
+
+		static std::size_t encode(char* s, char32_t const* w, std::size_t n);
+		static std::size_t encode(char* s, char16_t const* w, std::size_t n);
+		static std::size_t encode(char* s, wchar_t const* w, std::size_t n);
+		// Bytes written to $s with room for 4n, or 3n from UTF-16
 	};
 }
 
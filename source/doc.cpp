@@ -10,9 +10,19 @@
 namespace doc
 {
 	template class instance<function>;
+	template class concurrent<function>;
 }
 
 #ifdef test_unit
+#include "dir.hpp"
+#include "env.hpp"
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <cstring>
+#include <thread>
+#include <cstdio>
+
 namespace
 {
 	struct dumb
@@ -73,4 +83,468 @@ test_unit(doc)
 
 	doc::access<dumb>().close(id);
 }
+
+test_unit(churn)
+{
+	// A million steps through the free bitmap, checked rather than timed
+	auto& that = doc::access<dumb>();
+	constexpr int size = 1 << 12;
+	constexpr int turns = 1'000'000;
+
+	for (int n = 0; n < size; ++n)
+	{
+		assert(n == that.open({}));
+	}
+
+	// Close and reopen at random, the hole is always lowest
+	unsigned seed = 1;
+	for (int n = 0; n < turns; ++n)
+	{
+		seed = seed * 1103515245 + 12345;
+		int const id = (seed >> 8) % size;
+		(void) that.close(id);
+		assert(that.gap() <= 1);
+		assert(id == that.open({}));
+	}
+
+	// Holes fill from the bottom
+	for (int n = 0; n < size; n += 2)
+	{
+		(void) that.close(n);
+	}
+	for (int n = 0; n < size; n += 2)
+	{
+		assert(n == that.open({}));
+	}
+	assert(0 == that.gap());
+
+	for (int n = size - 1; 0 <= n; --n)
+	{
+		(void) that.close(n);
+	}
+	assert(0 == that.gap());
+	assert(nullptr == that.find(0));
+}
+
+test_unit(soa)
+{
+	auto& aos = doc::access<dumb>();
+	auto& soa = doc::access<dumb, doc::columns>();
+	constexpr int size = 1 << 16;
+
+	fwd::vector<int> rows, ids;
+	for (int n = 0; n < size; ++n)
+	{
+		dumb d;
+		d.i = n;
+		rows.push_back(aos.open(dumb(d)));
+		ids.push_back(soa.open(std::move(d)));
+	}
+
+	// Leave holes so that columns are compacted
+	for (int n = 0; n < size; n += 3)
+	{
+		(void) aos.close(rows.at(n));
+		(void) soa.close(ids.at(n));
+	}
+
+	// Same field sum by object and by column
+	long long by_row = 0, by_column = 0;
+	for (auto const id : rows)
+	{
+		if (auto const ptr = aos.find(id))
+		{
+			by_row += ptr->i;
+		}
+	}
+	for (auto const i : soa.column<0>())
+	{
+		by_column += i;
+	}
+	assert(by_row == by_column);
+
+	// Columns line up with their ids
+	auto const column = soa.column<0>();
+	auto const open = soa.ids();
+	assert(column.size() == open.size());
+	for (auto k = fmt::null; k < column.size(); ++k)
+	{
+		auto const id = fmt::to_int(open[k]);
+		assert(soa.value<0>(id) == column[k]);
+		assert(soa.value<2>(id) == "Hello World");
+	}
+
+	for (int n = 1; n < size; ++n)
+	{
+		if (n % 3)
+		{
+			(void) aos.close(rows.at(n));
+			(void) soa.close(ids.at(n));
+		}
+	}
+	assert(0 == soa.gap() and soa.ids().empty());
+}
+
+test_unit(matrix)
+{
+	fwd::matrix<int, double, fmt::string> table;
+	fwd::vector<int> const ints { 5, 3, 9, 1, 3, 7 };
+	fwd::vector<double> const reals { 0.5, 0.25, 2.0, 1.0, 0.75, 4.0 };
+	fwd::vector<fmt::string> const names { "e", "c", "i", "a", "d", "g" };
+	table.append(ints, reals, names);
+	table.append(ints, reals, names);
+	assert(12 == table.size());
+
+	// Reductions over whole columns
+	assert(56 == table.sum<0>());
+	assert(17.0 == table.sum<1>());
+	assert(1 == table.min<0>() and 9 == table.max<0>());
+	assert(0.25 == table.min<1>() and 4.0 == table.max<1>());
+	assert(56LL == (table.fold<0, long long>()));
+
+	// Stable selection and reduction over it
+	auto const big = table.select<0>([](int i) { return 3 < i; });
+	assert(6 == big.size());
+	assert(0 == big.front() and 11 == big.back());
+	assert(42 == table.fold<0>(big));
+	auto const some = table.gather(big);
+	assert(big.size() == some.size());
+	assert(5 == some.min<0>() and 9 == some.max<0>());
+
+	// Sorted by a column keeps ties in order
+	table.sort<0>();
+	auto const& sorted = table.column<0>();
+	assert(std::is_sorted(sorted.begin(), sorted.end()));
+	assert("c" == table.column<2>().at(2) and "d" == table.column<2>().at(3));
+	assert("c" == table.column<2>().at(4) and "d" == table.column<2>().at(5));
+	assert(1.0 == table.column<1>().front());
+
+	auto const desc = table.order<1>(std::greater<>());
+	assert(4.0 == table.column<1>().at(desc.front()));
+
+	// Small types promote in the operation and fold back
+	fwd::matrix<short> shorts;
+	fwd::vector<short> const values { 7, -2, 300, 11, 5, -40, 9 };
+	shorts.append(values);
+	auto const total = shorts.sum<0>();
+	static_assert(std::is_same_v<decltype(total), short const>);
+	assert(290 == total);
+	assert(-40 == shorts.min<0>() and 300 == shorts.max<0>());
+	assert(290L == (shorts.fold<0, long>()));
+}
+
+test_unit(sparse)
+{
+	using graph = fwd::sparse<int>;
+	fwd::graph<int> arcs;
+	// Diamond 10 -> {20, 30} -> 40 with a repeated arc and a loose pair
+	for (auto [from, to] : { std::pair(10, 20), std::pair(10, 30), std::pair(20, 40), std::pair(30, 40), std::pair(10, 20), std::pair(60, 50) })
+	{
+		arcs.emplace_back(from, to);
+	}
+	graph const g(arcs);
+	assert(6 == g.size() and 5 == g.arcs());
+	assert(graph::none == g.find(15));
+	auto const v = g.find(10);
+	assert(0 == v and 10 == g.at(v));
+	assert(2 == g.next(v).size() and 1 == g.next(v).front());
+
+	auto const level = g.breadth(v);
+	assert(0 == level[0] and 1 == level[1] and 1 == level[2] and 2 == level[3]);
+	assert(graph::none == level[g.find(50)]);
+
+	auto const pre = g.depth(v);
+	assert((pre == fwd::vector<size_t> { 0, 1, 3, 2 }));
+
+	auto const order = g.order();
+	assert((order == fwd::vector<size_t> { 0, 5, 1, 2, 4, 3 }));
+	assert((g.parts() == fwd::vector<size_t> { 0, 0, 0, 0, 4, 4 }));
+
+	auto const back = g.reverse();
+	assert(5 == back.arcs() and 2 == back.next(back.find(40)).size());
+	assert(back.order().size() == g.size());
+
+	// Any cycle leaves no order
+	arcs.emplace_back(40, 10);
+	assert(graph(arcs).order().empty());
+
+	// Adjacency lists keep nodes without arcs
+	fwd::vector<int> heads { 2, 3 };
+	fwd::vector<fwd::edges<int>> const lists { { 1, heads }, { 4, { } } };
+	graph const h(lists);
+	assert(4 == h.size() and 2 == h.arcs());
+	assert((h.parts() == fwd::vector<size_t> { 0, 0, 0, 3 }));
+
+	fwd::group<int> const map { { { 1, 2 }, 0 }, { { 2, 3 }, 0 } };
+	assert(2 == graph(map).arcs());
+
+	// Large enough to run on many threads, same answer as on one
+	constexpr int nodes = 1 << 16;
+	fwd::graph<int> wide;
+	for (int n = 1; n < nodes; ++n)
+	{
+		if (n % 1000)
+		{
+			wide.emplace_back(n / 2, n);
+			wide.emplace_back(n * 7919 % nodes % n, n);
+		}
+	}
+	graph const big(wide);
+	assert(big.breadth(0, 4) == big.breadth(0, 1));
+	assert(big.order(4) == big.order(1));
+	assert(big.parts(4) == big.parts(1));
+	assert(big.order().size() == big.size());
+}
+
+test_unit(small)
+{
+	fmt::string::small<4> list { "a", "b", "c" };
+	auto const inside = [](auto const& that)
+	{
+		auto const begin = reinterpret_cast<char const*>(&that);
+		auto const at = reinterpret_cast<char const*>(that.data());
+		return begin <= at and at < begin + sizeof that;
+	};
+	assert(3 == list.size() and 4 == list.capacity() and inside(list));
+
+	// Growing from an element of itself
+	list.push_back(list.front());
+	list.push_back(list.back());
+	assert(5 == list.size() and 4 < list.capacity() and not inside(list));
+	assert("a" == list.at(3) and "a" == list.at(4));
+
+	auto copy = list;
+	auto moved = std::move(copy);
+	assert(copy.empty() and moved == list);
+	moved.resize(2);
+	assert(2 == moved.size() and "b" == moved.back());
+
+	fwd::inplace<4>::vector<fmt::string::type> few { "x", "y" };
+	auto other = std::move(few);
+	assert(few.empty() and 2 == other.size() and inside(other));
+	other = list;
+	assert(other == list);
+	other.clear();
+	assert(other.empty());
+
+	fmt::string::span const parts = list;
+	assert(5 == parts.size() and "c" == parts[2]);
+
+	auto const path = fmt::dir::join({ "usr", "local", "bin" });
+	auto const folders = fmt::dir::split(path);
+	assert(3 == folders.size() and "bin" == folders.back() and inside(folders));
+}
+
+test_unit(concurrent)
+{
+	auto& that = doc::shared<dumb>();
+	constexpr int threads = 4;
+	constexpr int turns = 10'000;
+
+	std::atomic<int> errors = 0;
+	fwd::vector<std::thread> pool;
+	for (int t = 0; t < threads; ++t)
+	{
+		pool.emplace_back([&that, &errors, t]
+		{
+			for (int n = 0; n < turns; ++n)
+			{
+				dumb d;
+				d.i = t * turns + n;
+				auto const id = that.open(std::move(d));
+				auto const hold = that.pin();
+				auto const ptr = that.find(id);
+				if (nullptr == ptr or ptr->i != t * turns + n)
+				{
+					++errors;
+				}
+				if (that.close(id) < 0 or nullptr != that.find(id))
+				{
+					++errors;
+				}
+				// Still alive for this pin
+				if (ptr->i != t * turns + n)
+				{
+					++errors;
+				}
+			}
+		});
+	}
+	for (auto& thread : pool)
+	{
+		thread.join();
+	}
+	assert(0 == errors);
+	assert(0 == that.size());
+
+	// Closing alone frees slots for more opens than there are
+	for (int n = 0; n < (1 << 21); ++n)
+	{
+		auto const id = that.open({});
+		if (id < 0 or that.close(id) < 0)
+		{
+			++errors;
+			break;
+		}
+	}
+	assert(0 == errors);
+	(void) that.compact();
+
+	// A pin keeps what it found past close and compact
+	{
+		auto const id = that.open({});
+		auto const hold = that.pin();
+		auto const ptr = that.find(id);
+		assert(0 == that.close(id));
+		assert(0 == that.compact());
+		assert(ptr->s == "Hello World");
+	}
+	assert(1 == that.compact());
+
+	// Old ids miss once the slot is reused
+	auto const id = that.open({});
+	assert(nullptr != that.find(id));
+	assert(0 == that.close(id));
+	assert(that.close(id) < 0);
+	assert(1 == that.compact());
+	auto const again = that.open({});
+	assert(nullptr == that.find(id));
+	assert(that.at(again).s == "Hello World");
+	assert(0 == that.close(again));
+	assert(1 == that.compact());
+}
+
+test_unit(snapshot)
+{
+	auto& that = doc::access<dumb>();
+	fwd::vector<int> ids;
+	for (int n = 0; n < 100; ++n)
+	{
+		dumb d;
+		d.i = n;
+		d.f = n / 2.0f;
+		d.s = std::to_string(n);
+		ids.push_back(that.open(std::move(d)));
+	}
+	(void) that.close(ids.at(50));
+
+	auto const path = fmt::dir::join({env::temp(), "snapshot.bin"});
+	assert(success == doc::snapshot<dumb>::save(path, that));
+
+	doc::snapshot<dumb> bin;
+	assert(success == bin.open(path));
+	assert(99 == bin.size());
+	assert(fmt::npos == bin.find(ids.at(50)));
+	for (int n = 0; n < 100; ++n)
+	{
+		if (50 == n)
+		{
+			continue;
+		}
+		auto const row = bin.find(ids.at(n));
+		assert(fmt::npos != row);
+		assert(bin.id(row) == ids.at(n));
+		assert(bin.value<0>(row) == n);
+		assert(bin.value<1>(row) == n / 2.0f);
+		assert(bin.value<2>(row) == std::to_string(n));
+	}
+
+	// Damaged once the rows point past the text
+	{
+		fmt::string bytes;
+		{
+			std::ifstream input(path, std::ios::binary);
+			bytes.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		}
+		std::uint64_t blob;
+		constexpr auto at = 4 * sizeof blob; // magic, schema, count, row
+		std::memcpy(&blob, bytes.data() + at, sizeof blob);
+		std::fill(bytes.begin() + at + sizeof blob, bytes.end() - blob, '\xFF');
+		{
+			std::ofstream output(path, std::ios::binary | std::ios::trunc);
+			output.write(bytes.data(), bytes.size());
+		}
+		assert(failure == bin.open(path));
+		assert(0 == bin.size());
+	}
+
+	for (int n = 0; n < 100; ++n)
+	{
+		if (50 != n)
+		{
+			(void) that.close(ids.at(n));
+		}
+	}
+	(void) std::remove(path.c_str());
+}
+
+test_unit(index)
+{
+	auto& that = doc::access<dumb>();
+	doc::hashed<dumb, 2> by_s;
+	doc::sorted<dumb, 0> by_i;
+
+	fwd::vector<int> ids;
+	for (int n = 0; n < 20; ++n)
+	{
+		dumb d;
+		d.i = n;
+		d.s = n % 2 ? "odd" : "even";
+		ids.push_back(that.open(std::move(d)));
+	}
+	assert(10 == by_s.find("odd").size());
+	assert(by_i.find(7) == fwd::vector<int> { ids.at(7) });
+
+	// Ranges come back in order of value
+	auto const five = by_i.range(5, 10);
+	assert(5 == five.size());
+	for (auto const n : { 0, 1, 2, 3, 4 })
+	{
+		assert(five.at(n) == ids.at(n + 5));
+	}
+
+	// Writes through set move the entry
+	that.set<0>(ids.at(3), 100);
+	assert(by_i.find(3).empty());
+	assert(by_i.find(100) == fwd::vector<int> { ids.at(3) });
+
+	// Close removes it
+	(void) that.close(ids.at(4));
+	assert(9 == by_s.find("even").size());
+
+	// Many equals grow the table and still leave one by one
+	{
+		fwd::vector<int> more;
+		for (int n = 0; n < 1000; ++n)
+		{
+			dumb d;
+			d.s = "same";
+			more.push_back(that.open(std::move(d)));
+		}
+		assert(1000 == by_s.find("same").size());
+		for (auto const id : more)
+		{
+			(void) that.close(id);
+		}
+		assert(by_s.find("same").empty());
+		assert(9 == by_s.find("even").size());
+	}
+
+	// A late index sees what is already open
+	{
+		doc::hashed<dumb, 0> late;
+		assert(1 == late.find(7).size());
+		assert(late.find(4).empty());
+	}
+
+	for (int n = 0; n < 20; ++n)
+	{
+		if (4 != n)
+		{
+			(void) that.close(ids.at(n));
+		}
+	}
+	assert(by_s.find("odd").empty());
+	assert(by_i.range(0, 1000).empty());
+}
 #endif
@@ -19,8 +19,12 @@
 #include "sync.hpp"
 #include <exception>
 #include <fstream>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <thread>
 #include <vector>
-#include <regex>
+#include <map>
 
 #ifdef _WIN32
 #include <shlobj.h>
@@ -163,40 +167,202 @@ namespace env::os
 			}
 		}
 
-		thread_local fmt::string::view::vector w;
+		thread_local fmt::string::view::small<> w;
 		w = fmt::dir::split(u);
 		return w;
 	}
 }
 
+namespace
+{
+	auto fold(char c)
+	// Environment names ignore case on WIN32
+	{
+		#ifdef _WIN32
+		{
+			auto const n = static_cast<unsigned char>(c);
+			return static_cast<char>(std::toupper(n));
+		}
+		#else
+		{
+			return c;
+		}
+		#endif
+	}
+
+	auto hash(fmt::string::view u)
+	// FNV-1a over the folded variable name
+	{
+		std::uint64_t h = 0xcbf29ce484222325;
+		for (auto c : u)
+		{
+			h ^= static_cast<unsigned char>(fold(c));
+			h *= 0x100000001b3;
+		}
+		return static_cast<std::size_t>(h);
+	}
+
+	bool same(fmt::string::view u, fmt::string::view v)
+	{
+		if (u.size() != v.size())
+		{
+			return false;
+		}
+		for (auto i = fmt::null; i < u.size(); ++i)
+		{
+			if (fold(u[i]) != fold(v[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool head(char c)
+	// First character of a $NAME
+	{
+		return '_' == c or ('A' <= c and c <= 'Z') or ('a' <= c and c <= 'z');
+	}
+
+	bool tail(char c)
+	// Other characters of a $NAME
+	{
+		return head(c) or ('0' <= c and c <= '9');
+	}
+
+	struct directories;
+	// Paths derived from the environment, see below
+
+	class snapshot : fwd::unique
+	// Immutable open addressed index over the environment block
+	{
+		fmt::string::view::vector keys;
+		fmt::string::view::vector values;
+		std::size_t mask;
+
+	public:
+
+		snapshot(char** env)
+		{
+			auto n = fmt::null;
+			for (auto c = env; *c; ++c) ++n;
+			// Keep load factor at or below one half
+			std::size_t z = 8;
+			while (z < 2 * n) z <<= 1;
+			keys.resize(z);
+			values.resize(z);
+			mask = z - 1;
+
+			for (auto c = env; *c; ++c)
+			{
+				auto const [k, v] = fmt::to_pair(*c);
+				if (k.empty())
+				{
+					continue; // WIN32 drive entries
+				}
+
+				auto i = hash(k) & mask;
+				while (not keys[i].empty() and not same(keys[i], k))
+				{
+					i = (i + 1) & mask;
+				}
+				// First entry wins as with getenv
+				if (keys[i].empty())
+				{
+					keys[i] = k;
+					values[i] = v;
+				}
+			}
+		}
+
+		using pointer = fmt::string::view::vector::const_pointer;
+
+		pointer find(fmt::string::view u) const
+		{
+			for (auto i = hash(u) & mask; not keys[i].empty(); i = (i + 1) & mask)
+			{
+				if (same(keys[i], u))
+				{
+					return values.data() + i;
+				}
+			}
+			return nullptr;
+		}
+	};
+}
+
 namespace env::var
 {
 	static sys::rwlock lock;
+	// Serializes writers, readers go through the snapshot
 
-	bool got(fmt::string::view u)
+	static std::shared_ptr<snapshot const> current;
+	static std::shared_ptr<directories> context;
+	// Guarded by the lock, old objects go when no thread pins them
+	static std::atomic<std::size_t> generation;
+	// Counts rebuilds so a pinned thread checks without the lock
+
+	template <class Type> struct pin
+	// Reference held by a thread until it sees a newer generation
 	{
-		if (not fmt::terminated(u))
+		std::shared_ptr<Type> ptr;
+		std::size_t seen = 0;
+
+		bool fresh()
+		{
+			return ptr and seen == generation.load(std::memory_order_acquire);
+		}
+
+		Type* hold(std::shared_ptr<Type> const& next, std::size_t now)
 		{
-			auto const s = fmt::to_string(u);
-			return env::var::got(s);
+			ptr = next;
+			seen = now;
+			return ptr.get();
 		}
-		auto const c = u.data();
-		auto const unlock = lock.read();
-		auto const ptr = std::getenv(c);
-		return nullptr == ptr;
+	};
+
+	static void rebuild()
+	// Copy on write with the lock held for writing
+	{
+		current = std::make_shared<snapshot const>(sys::environ());
+		// Derived paths are built again on next use
+		context.reset();
+		generation.fetch_add(1, std::memory_order_acq_rel);
 	}
 
-	fmt::string::view get(fmt::string::view u)
+	static snapshot const* load()
 	{
-		if (not fmt::terminated(u))
+		thread_local pin<snapshot const> local;
+		if (local.fresh())
+		{
+			return local.ptr.get();
+		}
+
+		{
+			auto const unlock = lock.read();
+			if (nullptr != current)
+			{
+				return local.hold(current, generation.load());
+			}
+		}
+
+		auto const unlock = lock.write();
+		if (nullptr == current)
 		{
-			auto const s = fmt::to_string(u);
-			return env::var::get(s);
+			rebuild();
 		}
-		auto const c = u.data();
-		auto const unlock = lock.read();
-		auto const ptr = std::getenv(c);
-		return nullptr == ptr ? "" : ptr;
+		return local.hold(current, generation.load());
+	}
+
+	bool got(fmt::string::view u)
+	{
+		return nullptr != load()->find(u);
+	}
+
+	fmt::string::view get(fmt::string::view u)
+	{
+		auto const ptr = load()->find(u);
+		return nullptr == ptr ? "" : *ptr;
 	}
 
 	bool set(fmt::string::view u)
@@ -208,7 +374,9 @@ namespace env::var
 		auto const unlock = lock.write();
 		auto const d = u.data();
 		auto c = const_cast<char*>(d);
-		return 0 != sys::putenv(c);
+		auto const no = sys::putenv(c);
+		rebuild();
+		return 0 != no;
 	}
 
 	bool put(fmt::string::view u)
@@ -218,7 +386,9 @@ namespace env::var
 		auto it = buf.emplace(u).first;
 		auto d = it->data();
 		auto c = const_cast<char*>(d);
-		return 0 != sys::putenv(c);
+		auto const no = sys::putenv(c);
+		rebuild();
+		return 0 != no;
 	}
 
 	bool put(fmt::string::view u, fmt::string::view v)
@@ -226,88 +396,267 @@ namespace env::var
 		return env::var::put(fmt::join({u, v}, "="));
 	}
 
-	fmt::string::view value(fmt::string::view u)
+	fmt::string::ref expand(fmt::string::view u, fmt::string::ref s)
 	{
-		thread_local fmt::string s;
-		fmt::string::stream ss;
-
-		#ifdef _WIN32
+		auto const z = u.size();
+		for (auto i = fmt::null; i < z; )
 		{
-			constexpr auto x = "%";
+			auto const j = u.find_first_of("$%", i);
+			s.append(u.substr(i, j - i));
+			if (fmt::npos == j)
+			{
+				break;
+			}
 
-			for (auto [i, j] = fmt::embrace(u, x); i < j; std::tie(i, j) = fmt::embrace(u, x))
+			auto const k = j + 1;
+			auto next = k;
+			fmt::string::view name;
+
+			if ('%' == u[j])
 			{
-				auto const prefix = u.substr(0, i);
-				auto const infix = u.substr(i + 1, j);
-				auto const suffix = u.substr(j + 1);
-				auto const value = get(infix);
-				ss << prefix << value << suffix;
+				auto const e = u.find('%', k);
+				if (fmt::npos != e)
+				{
+					name = u.substr(k, e - k);
+					next = e + 1;
+					// Escaped %% or unknown %NAME% stay as written
+					if (name.empty() or not got(name))
+					{
+						s.append(u.substr(j, next - j - (name.empty() ? 1 : 0)));
+						i = next;
+						continue;
+					}
+				}
 			}
-		}
-		#else // POSIX
-		{
-			static std::regex x { "\\$[A-Z_][A-Z_0-9]*" };
-			std::smatch m;
-			
-			auto s = fmt::to_string(u);
-			while (std::regex_search(s, m, x))
+			else
+			if (k < z and '{' == u[k])
 			{
-				auto const prefix = m.prefix();
-				auto const infix = m.str().substr(1);
-				auto const suffix = m.suffix();
-				auto const value = get(infix);
-				ss << prefix << value << suffix;
+				auto const e = u.find('}', k);
+				if (fmt::npos != e)
+				{
+					name = u.substr(k + 1, e - k - 1);
+					next = e + 1;
+				}
+			}
+			else
+			{
+				auto e = k;
+				if (e < z and head(u[e]))
+				{
+					while (++e < z and tail(u[e]));
+				}
+				name = u.substr(k, e - k);
+				next = e;
 			}
-		}
-		#endif
 
-		s = ss.str();
+			if (name.empty())
+			{
+				s += u[j];
+				i = k;
+			}
+			else
+			{
+				s.append(get(name));
+				i = next;
+			}
+		}
 		return s;
 	}
-}
 
-namespace env
-{
-	fmt::string::view::span vars()
+	fmt::string::view value(fmt::string::view u)
 	{
-		static thread_local fmt::string::view::vector local;
-		local.clear();
-		for (auto c = sys::environ(); *c; ++c) local.emplace_back(c);
-		return local;
-	}
+		// Views returned before stay valid until this thread sees a change
+		thread_local struct
+		{
+			std::size_t from = ~fmt::null;
+			std::map<fmt::string, fmt::string, std::less<>> map;
+			// Expansions in the environment of that generation
+		} memo;
 
-	fmt::string::view::span paths()
-	{
-		static thread_local fmt::string::view::vector t;
-		auto u = env::var::get("PATH");
-		t = fmt::path::split(u);
-		return t;
+		// Free expansions of an older environment with it
+		(void) load();
+		auto const now = generation.load(std::memory_order_acquire);
+		if (memo.from != now)
+		{
+			memo.from = now;
+			memo.map.clear();
+		}
+
+		auto it = memo.map.find(u);
+		if (memo.map.end() == it)
+		{
+			fmt::string s;
+			(void) expand(u, s);
+			it = memo.map.emplace(u, std::move(s)).first;
+		}
+		return it->second;
 	}
+}
 
-	fmt::string::view temp()
+namespace
+{
+	fmt::string::view either(fmt::string::view::init names)
+	// First variable among names which is not empty
 	{
-		for (auto u : { "TMPDIR", "TEMP", "TMP" })
+		for (auto u : names)
 		{
-			auto v = env::var::get(u);
+			auto const v = env::var::get(u);
 			if (not empty(v))
 			{
 				return v;
 			}
 		}
-		static fmt::string s;
-		if (empty(s))
+		return fmt::empty;
+	}
+
+	struct directories : fwd::unique
+	// Immutable once published, rebuilt when the environment changes
+	{
+		fmt::string::view::vector vars;
+		fmt::string::view::vector paths;
+		fmt::string::view::vector data_dirs;
+		fmt::string::view::vector config_dirs;
+		fmt::string data_path;
+		fmt::string config_path;
+		fmt::string temp;
+		fmt::string run_dir;
+		fmt::string data_home;
+		fmt::string config_home;
+		fmt::string cache_home;
+
+		directories()
 		{
-			#ifdef _WIN32
+			for (auto c = sys::environ(); *c; ++c)
 			{
-				s = fmt::dir::join({env::root(), "Temp"});
+				vars.emplace_back(*c);
 			}
-			#else
+
+			paths = fmt::path::split(env::var::get("PATH"));
+
+			temp = either({ "TMPDIR", "TEMP", "TMP" });
+			if (empty(temp))
 			{
-				s = fmt::dir::join({env::base(), "tmp"});
+				#ifdef _WIN32
+				{
+					temp = fmt::dir::join({env::root(), "Temp"});
+				}
+				#else
+				{
+					temp = fmt::dir::join({env::base(), "tmp"});
+				}
+				#endif
 			}
-			#endif
+
+			run_dir = env::var::get("XDG_RUNTIME_DIR");
+			if (empty(run_dir))
+			{
+				run_dir = fmt::dir::join({temp, "run", env::user()});
+			}
+
+			data_home = env::var::get("XDG_DATA_HOME");
+			if (empty(data_home))
+			{
+				data_home = fmt::dir::join({env::home(), ".local", "share"});
+			}
+
+			config_home = env::var::get("XDG_CONFIG_HOME");
+			if (empty(config_home))
+			{
+				config_home = fmt::dir::join({env::home(), ".config"});
+			}
+
+			cache_home = env::var::get("XDG_CACHE_HOME");
+			if (empty(cache_home))
+			{
+				cache_home = fmt::dir::join({env::home(), ".cache"});
+			}
+
+			data_path = env::var::get("XDG_DATA_DIRS");
+			if (empty(data_path))
+			{
+				#ifdef _WIN32
+				{
+					data_path = env::var::get("ALLUSERSPROFILE");
+				}
+				#else
+				{
+					data_path = "/usr/local/share/:/usr/share/";
+				}
+				#endif
+			}
+			data_dirs = fmt::path::split(data_path);
+
+			config_path = env::var::get("XDG_CONFIG_DIRS");
+			if (empty(config_path))
+			{
+				#ifdef _WIN32
+				{
+					auto const appdata = env::var::get("APPDATA");
+					auto const local = env::var::get("LOCALAPPDATA");
+					config_path = fmt::path::join({appdata, local});
+				}
+				#else
+				{
+					config_path = "/etc/xdg";
+				}
+				#endif
+			}
+			config_dirs = fmt::path::split(config_path);
 		}
-		return s;
+	};
+
+	directories* dirs()
+	// One counter load unless the environment changed since last use
+	{
+		// Views returned before stay valid until this thread sees a change
+		thread_local env::var::pin<directories> local;
+		if (local.fresh())
+		{
+			return local.ptr.get();
+		}
+
+		for (;;)
+		{
+			auto const now = env::var::generation.load(std::memory_order_acquire);
+			{
+				auto const unlock = env::var::lock.read();
+				if (nullptr != env::var::context and now == env::var::generation.load())
+				{
+					return local.hold(env::var::context, now);
+				}
+			}
+
+			// Built without the lock since it reads variables itself
+			auto next = std::make_shared<directories>();
+			auto const unlock = env::var::lock.write();
+			if (now == env::var::generation.load())
+			{
+				if (nullptr == env::var::context)
+				{
+					env::var::context = std::move(next);
+				}
+				return local.hold(env::var::context, now);
+			}
+			// The environment changed while building, try again
+		}
+	}
+}
+
+namespace env
+{
+	fmt::string::view::span vars()
+	{
+		return dirs()->vars;
+	}
+
+	fmt::string::view::span paths()
+	{
+		return dirs()->paths;
+	}
+
+	fmt::string::view temp()
+	{
+		return dirs()->temp;
 	}
 
 	fmt::string::view pwd()
@@ -507,105 +856,32 @@ namespace env::usr
 
 	fmt::string::view run_dir()
 	{
-		auto u = env::var::get("XDG_RUNTIME_DIR");
-		if (empty(u))
-		{
-			static auto const path = fmt::dir::join({env::temp(), "run", env::user()});
-			u = path;
-		}
-		return u;
+		return dirs()->run_dir;
 	}
 
 	fmt::string::view data_home()
 	{
-		auto u = env::var::get("XDG_DATA_HOME");
-		if (empty(u))
-		{
-			static fmt::string s;
-			if (empty(s))
-			{
-				s = fmt::dir::join({env::home(), ".local", "share"});
-			}
-			u = s;
-		}
-		return u;
+		return dirs()->data_home;
 	}
 
 	fmt::string::view config_home()
 	{
-		auto u = env::var::get("XDG_CONFIG_HOME");
-		if (empty(u))
-		{
-			static fmt::string s;
-			if (empty(s))
-			{
-				s = fmt::dir::join({env::home(), ".config"});
-			}
-			u = s;
-		}
-		return u;
+		return dirs()->config_home;
 	}
 
 	fmt::string::view cache_home()
 	{
-		auto u = env::var::get("XDG_CACHE_HOME");
-		if (empty(u))
-		{
-			static fmt::string s;
-			if (empty(s))
-			{
-				s = fmt::dir::join({env::home(), ".cache"});
-			}
-			u = s;
-		}
-		return u;
+		return dirs()->cache_home;
 	}
 
 	fmt::string::view::span data_dirs()
 	{
-		static fmt::string::view::vector t;
-		auto u = env::var::get("XDG_DATA_DIRS");
-		if (empty(u))
-		{
-			#ifdef _WIN32
-			{
-				u = env::var::get("ALLUSERSPROFILE");
-			}
-			#else
-			{
-				u = "/usr/local/share/:/usr/share/";
-			}
-			#endif
-		}
-		t = fmt::path::split(u);
-		return t;
+		return dirs()->data_dirs;
 	}
 
 	fmt::string::view::span config_dirs()
 	{
-		static fmt::string::view::vector t;
-		auto u = env::var::get("XDG_CONFIG_DIRS");
-		if (empty(u))
-		{
-			#ifdef _WIN32
-			{
-				static fmt::string s;
-				if (empty(s))
-				{
-					auto const appdata = fmt::to_string(env::var::get("APPDATA"));
-					auto const local = fmt::to_string(env::var::get("LOCALAPPDATA"));
-					s = fmt::path::join({appdata, local});
-				}
-				u = s;
-			}
-			#else
-			{
-				u = "/etc/xdg";
-			}
-			#endif
-		}
-		t = fmt::path::split(u);
-		return t;
+		return dirs()->config_dirs;
 	}
 
 	fmt::string::view desktop_dir()
@@ -691,7 +967,7 @@ namespace env
 
 	shell::page shell::run(init arguments)
 	{
-		view::vector s(arguments);
+		view::small<> s(arguments);
 		return run(s);
 	}
 
@@ -837,7 +1113,7 @@ namespace env
 		}
 
 		// Program is first command in paired
-		fwd::vector<char const*> list;
+		fwd::small<char const*, 16> list;
 		list.push_back(data(program));
 
 		// Arguments null terminated
@@ -1134,6 +1410,29 @@ test_unit(env)
 {
 	assert(env::var::get("PATH") == fmt::path::join(env::paths()));
 	assert(env::var::get("PATH") == env::var::value("$PATH"));
+	assert(env::var::get("PATH") == env::var::value("${PATH}"));
+	assert(env::var::get("PATH") == env::var::value("%PATH%"));
+	assert(env::var::value("100%") == "100%");
+	assert(env::var::value("%%") == "%");
+	assert(success == env::var::put("ENV_TEST", "42"));
+	assert(env::var::got("ENV_TEST"));
+	assert(env::var::get("ENV_TEST") == "42");
+
+	// A snapshot goes once the threads pinning it have moved on or ended
+	std::weak_ptr<void const> const old = []
+	{
+		auto const unlock = env::var::lock.read();
+		return std::weak_ptr<void const>(env::var::current);
+	}();
+	std::thread([] { assert(env::var::get("ENV_TEST") == "42"); }).join();
+	assert(success == env::var::put("ENV_TEST", "43"));
+	assert(env::var::get("ENV_TEST") == "43");
+	assert(old.expired());
+
+	// Expansions follow the environment, copies outlive a change
+	fmt::string const before(env::var::value("$ENV_TEST"));
+	assert(success == env::var::put("ENV_TEST", "44"));
+	assert(env::var::value("$ENV_TEST") == "44" and before == "43");
 }
 
 test_unit(shell)
@@ -23,6 +23,8 @@
 #include <algorithm>
 #include <regex>
 #include <stack>
+#include <fstream>
+#include <cstdio>
 
 #ifdef _WIN32
 # include "win/memory.hpp"
@@ -44,9 +46,10 @@ namespace fmt::dir
 		return fmt::join(p, sys::sep::dir);
 	}
 
-	string::view::vector split(string::view u)
+	string::view::small<> split(string::view u)
 	{
-		return fmt::split(u, sys::sep::dir);
+		auto const folders = fmt::split(u, sys::sep::dir);
+		return { folders.begin(), folders.end() };
 	}
 }
 
@@ -536,14 +539,14 @@ namespace env::file
 
 	bool process::start(fmt::string::view::init args)
 	{
-		fmt::string::view::vector t(args);
+		fmt::string::view::small<> t(args);
 		return start(fmt::string::view::span(t));
 	}
 
 	bool process::start(fmt::string::view::span args)
 	{
 		fmt::string::view const del("\0", 1);
-		std::vector<char const *> list;
+		fwd::small<char const *, 16> list;
 		auto s = fmt::join(args, del);
 		for (auto u : fmt::split(s, del))
 		{
@@ -934,6 +937,71 @@ namespace env::file
 		}
 		#endif
 	}
+
+	map_ptr open_map(fmt::string::view path, size_t *out)
+	{
+		size_t n = 0;
+		if (nullptr == out) out = &n;
+		*out = 0;
+
+		if (fail(path, rd))
+		{
+			return nullptr;
+		}
+
+		descriptor const fd(path, rd);
+		if (fail(fd.get()))
+		{
+			return nullptr;
+		}
+
+		// Empty files have nothing to map
+		struct sys::stat const st(fd.get());
+		if (sys::fail(st) or 0 == st.st_size)
+		{
+			return nullptr;
+		}
+
+		auto ptr = make_map(fd.get(), 0, 0, rd, out);
+		#ifndef _WIN32
+		{
+			if (MAP_FAILED == ptr.get())
+			{
+				ptr.reset();
+			}
+		}
+		#endif
+		if (nullptr == ptr)
+		{
+			*out = 0;
+		}
+		return ptr;
+	}
+
+	bool replace(fmt::string::view path, fmt::string::view::init parts)
+	{
+		auto const file = fmt::to_string(path);
+		auto const temp = file + ".tmp";
+		{
+			std::ofstream output(temp, std::ios::binary | std::ios::trunc);
+			for (auto const part : parts)
+			{
+				output.write(part.data(), part.size());
+			}
+			if (not output.flush())
+			{
+				(void) std::remove(temp.c_str());
+				return failure;
+			}
+		}
+		if (0 != std::rename(temp.c_str(), file.c_str()))
+		{
+			sys::warn(here, "rename", temp, file);
+			(void) std::remove(temp.c_str());
+			return failure;
+		}
+		return success;
+	}
 }
 
 #ifdef test_unit
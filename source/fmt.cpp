@@ -9,11 +9,19 @@
 #include "sync.hpp"
 #include "err.hpp"
 #include <sstream>
-#include <iomanip>
 #include <charconv>
 #include <system_error>
+#include <limits>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <array>
+#include <bit>
 #include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace
 {
@@ -24,6 +32,7 @@ namespace
 		sys::exclusive<fmt::string::set> cache;
 		sys::exclusive<fmt::view::vector> store;
 		sys::exclusive<std::map<fmt::view, fmt::name>> table;
+		// Writers lock store, then cache, then table, skipping any unused
 
 	public:
 
@@ -88,7 +97,11 @@ namespace
 			auto const id = fmt::to<fmt::name>(size);
 			{
 				auto [it, unique] = table.write()->emplace(key, id);
-				assert(unique);
+				if (not unique)
+				{
+					// Another writer came first
+					return ~it->second;
+				}
 				writer->push_back(it->first);
 			}
 			return ~id;
@@ -111,11 +124,19 @@ namespace
 			auto const size = writer->size();
 			auto const id = fmt::to<fmt::name>(size);
 			{
+				auto wcache = cache.write();
+				auto wtable = table.write();
+				// Another writer came first
+				auto const it = wtable->find(key);
+				if (wtable->end() != it)
+				{
+					return ~it->second;
+				}
 				// Cache the string here
-				auto const p = cache.write()->emplace(key);
+				auto const p = wcache->emplace(key);
 				verify(p.second);
 				// Index a view to the string
-				auto const q = table.write()->emplace(*p.first, id);
+				auto const q = wtable->emplace(*p.first, id);
 				verify(q.second);
 
 				writer->push_back(q.first->first);
@@ -123,11 +144,41 @@ namespace
 			return ~id;
 		}
 
+		fmt::diff::vector set(fmt::view::span keys)
+		{
+			fmt::diff::vector ids;
+			ids.reserve(keys.size());
+
+			// One lock for the whole batch
+			auto wstore = store.write();
+			auto wcache = cache.write();
+			auto wtable = table.write();
+
+			for (fmt::view const key : keys)
+			{
+				auto it = wtable->find(key);
+				if (wtable->end() == it)
+				{
+					auto const size = wstore->size();
+					auto const id = fmt::to<fmt::name>(size);
+					// Cache the string here
+					auto const p = wcache->emplace(key);
+					// Index a view to the string
+					auto const q = wtable->emplace(*p.first, id);
+					verify(q.second);
+					wstore->push_back(q.first->first);
+					it = q.first;
+				}
+				ids.push_back(~it->second);
+			}
+			return ids;
+		}
+
 		fmt::string::in::ref get(fmt::string::in::ref in, char end)
 		{
 			// Block all threads at this point
-			auto wcache = cache.write();
 			auto wstore = store.write();
+			auto wcache = cache.write();
 			auto wtable = table.write();
 
 			fmt::string line;
@@ -201,54 +252,504 @@ namespace
 	template <typename T>
 	fmt::string from_base(T value, int base)
 	{
-		fmt::string s(20, '\0');
-		do
+		// Room for every binary digit and a sign
+		char buf[std::numeric_limits<T>::digits + 2];
+		auto const code = std::to_chars(buf, buf + sizeof buf, value, base);
+		if (noerr != code.ec)
+		{
+			auto const error = std::make_error_code(code.ec);
+			auto const message = error.message();
+			sys::warn(here, message);
+			return { };
+		}
+		return fmt::string(buf, code.ptr);
+	}
+
+	bool delimiter(char c)
+	// Separators between numbers in bulk
+	{
+		return ' ' == c or ',' == c or ';' == c or ('\t' <= c and c <= '\r');
+	}
+
+	constexpr auto hex = []
+	{
+		std::array<unsigned char, 256> table { };
+		table.fill(0xFF);
+		for (int c = 0; c < 10; ++c) table['0' + c] = c;
+		for (int c = 0; c < 6; ++c) table['a' + c] = table['A' + c] = 10 + c;
+		return table;
+	}();
+
+	bool eight(char const* it)
+	// Eight decimal digits, checked as one word
+	{
+		std::uint64_t n;
+		std::memcpy(&n, it, sizeof n);
+		constexpr std::uint64_t high = 0xF0F0F0F0F0F0F0F0;
+		constexpr std::uint64_t zero = 0x3030303030303030;
+		constexpr std::uint64_t six = 0x0606060606060606;
+		return zero == (n & high) and zero == ((n + six) & high);
+	}
+
+	std::uint32_t eights(char const* it)
+	// Value of eight decimal digits in three multiplies
+	{
+		std::uint64_t n;
+		std::memcpy(&n, it, sizeof n);
+		n -= 0x3030303030303030;
+		n = (n * 10) + (n >> 8);
+		n = (((n & 0x000000FF000000FF) * 0x000F424000000064)
+		  + (((n >> 16) & 0x000000FF000000FF) * 0x0000271000000001)) >> 32;
+		return static_cast<std::uint32_t>(n);
+	}
+
+	template <typename T>
+	bool to_base(char const* first, char const* last, T& value, int base)
+	{
+		using U = std::make_unsigned_t<T>;
+		auto it = first;
+		bool minus = false;
+		if constexpr (std::is_signed_v<T>)
 		{
-			auto begin = data(s);
-			auto end = begin + size(s);
-			auto code = std::to_chars(begin, end, value, base);
-			if (noerr != code.ec)
+			if (it < last and '-' == *it)
 			{
-				if (std::errc::value_too_large == code.ec)
+				minus = true;
+				++it;
+			}
+		}
+		auto const digits = last - it;
+
+		// Short decimals cannot overflow
+		if (10 == base and 0 < digits and digits <= std::numeric_limits<T>::digits10)
+		{
+			U n = 0;
+			if constexpr (std::endian::little == std::endian::native)
+			{
+				for (; 8 <= last - it; it += 8)
 				{
-					s.resize(2*s.size(), '\0');
-					continue;
+					if (not eight(it))
+					{
+						return failure;
+					}
+					n = n * 100000000 + eights(it);
+				}
+			}
+			for (; it < last; ++it)
+			{
+				auto const d = static_cast<unsigned>(*it - '0');
+				if (9 < d)
+				{
+					return failure;
+				}
+				n = n * 10 + d;
+			}
+			value = minus ? static_cast<T>(0 - n) : static_cast<T>(n);
+			return success;
+		}
+
+		// Nor short hexadecimals
+		if (16 == base and 0 < digits and digits * 4 < std::numeric_limits<T>::digits)
+		{
+			U n = 0;
+			for (; it < last; ++it)
+			{
+				auto const d = hex[static_cast<unsigned char>(*it)];
+				if (15 < d)
+				{
+					return failure;
+				}
+				n = n << 4 | d;
+			}
+			value = minus ? static_cast<T>(0 - n) : static_cast<T>(n);
+			return success;
+		}
+
+		// Long numbers and other bases check for overflow
+		auto const code = std::from_chars(first, last, value, base);
+		return noerr != code.ec or last != code.ptr;
+	}
+
+	template <typename T>
+	std::size_t to_bulk(fmt::string::view u, fwd::vector<T>& out, int base)
+	{
+		std::size_t count = 0;
+		auto const end = u.data() + u.size();
+		for (auto it = u.data(); it < end; )
+		{
+			if (delimiter(*it))
+			{
+				++it;
+				continue;
+			}
+
+			auto const first = it;
+			while (it < end and not delimiter(*it))
+			{
+				++it;
+			}
+
+			T value;
+			if (to_base(first, it, value, base))
+			{
+				sys::warn(here, fmt::string::view(first, it - first));
+				continue;
+			}
+			out.push_back(value);
+			++count;
+		}
+		return count;
+	}
+
+	template <typename T>
+	fmt::string::ref from_bulk(fwd::span<T const> values, fmt::string::ref out, char separator, int base)
+	{
+		// Reserve the longest text for each number once
+		constexpr auto most = std::numeric_limits<T>::digits + 2;
+		auto const start = out.size();
+		auto at = start;
+		out.resize(start + values.size() * most);
+		for (auto const value : values)
+		{
+			if (start != at)
+			{
+				out[at++] = separator;
+			}
+			auto const begin = out.data();
+			auto const code = std::to_chars(begin + at, begin + out.size(), value, base);
+			at = code.ptr - begin;
+		}
+		out.resize(at);
+		return out;
+	}
+
+	template <typename T>
+	char* from_fp(char* begin, char* end, T value, int precision)
+	{
+		#ifdef __cpp_lib_to_chars
+		{
+			auto const code = precision < 0
+				? std::to_chars(begin, end, value)
+				: std::to_chars(begin, end, value, std::chars_format::fixed, precision);
+			return noerr == code.ec ? code.ptr : nullptr;
+		}
+		#else
+		{
+			// Without library support print and widen until it reads back
+			constexpr bool quad = std::is_same_v<T, long double>;
+			auto const fixed = quad ? "%.*Lf" : "%.*f";
+			auto const general = quad ? "%.*Lg" : "%.*g";
+			auto const size = fmt::to_size(end - begin);
+
+			int n = -1;
+			if (precision < 0)
+			{
+				constexpr int most = std::numeric_limits<T>::max_digits10;
+				for (int digits = 1; digits <= most; ++digits)
+				{
+					n = std::snprintf(begin, size, general, digits, value);
+					if (n < 0 or size <= fmt::to_size(n))
+					{
+						return nullptr;
+					}
+					if (static_cast<T>(std::strtold(begin, nullptr)) == value)
+					{
+						break;
+					}
+				}
+			}
+			else
+			{
+				n = std::snprintf(begin, size, fixed, precision, value);
+				if (n < 0 or size <= fmt::to_size(n))
+				{
+					return nullptr;
 				}
-				auto const error = std::make_error_code(code.ec);
-				auto const message = error.message();
-				sys::warn(here, message);
 			}
-			s.resize(code.ptr - begin);
+			return begin + n;
 		}
-		while (0);
-		s.shrink_to_fit();
-		return s;
+		#endif
 	}
 
 	template <typename T>
 	fmt::string from_fp(T value, int precision)
 	{
-		/* we somehow still have no compiler support
-		fmt::string s(20, '\0');
-		do
+		// Most values fit on the stack
+		char buf[64];
+		if (auto const end = from_fp(buf, buf + sizeof buf, value, precision))
+		{
+			return fmt::string(buf, end);
+		}
+
+		// Fixed digits of a large magnitude
+		fmt::string s(2 * sizeof buf, '\0');
+		for (;;)
+		{
+			auto const begin = s.data();
+			if (auto const end = from_fp(begin, begin + s.size(), value, precision))
+			{
+				s.resize(end - begin);
+				return s;
+			}
+			s.resize(2 * s.size(), '\0');
+		}
+	}
+
+	using byte = unsigned char;
+	constexpr char32_t replacement = 0xFFFD;
+
+	std::size_t ascii(byte const* u, std::size_t n)
+	// Length of the run of ASCII at the front
+	{
+		std::size_t i = 0;
+		#ifdef __SSE2__
+		for (; i + 16 <= n; i += 16)
+		{
+			auto const x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(u + i));
+			if (auto const m = _mm_movemask_epi8(x); 0 != m)
+			{
+				return i + std::countr_zero(fmt::to<unsigned>(m));
+			}
+		}
+		#else
+		for (; i + 8 <= n; i += 8)
+		{
+			std::uint64_t x;
+			std::memcpy(&x, u + i, sizeof x);
+			if (auto const m = x & 0x8080808080808080; 0 != m)
+			{
+				if constexpr (std::endian::little == std::endian::native)
+				{
+					return i + std::countr_zero(m) / 8;
+				}
+				else break;
+			}
+		}
+		#endif
+		while (i < n and u[i] < 0x80)
+		{
+			++i;
+		}
+		return i;
+	}
+
+	template <class Wide> void widen(Wide* w, byte const* u, std::size_t n)
+	// Copy a run of ASCII into wider units
+	{
+		std::size_t i = 0;
+		#ifdef __SSE2__
+		auto const zero = _mm_setzero_si128();
+		for (; i + 16 <= n; i += 16)
+		{
+			auto const x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(u + i));
+			auto const lo = _mm_unpacklo_epi8(x, zero);
+			auto const hi = _mm_unpackhi_epi8(x, zero);
+			auto const to = reinterpret_cast<__m128i*>(w + i);
+			if constexpr (2 == sizeof (Wide))
+			{
+				_mm_storeu_si128(to, lo);
+				_mm_storeu_si128(to + 1, hi);
+			}
+			else
+			{
+				_mm_storeu_si128(to, _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128(to + 1, _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128(to + 2, _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128(to + 3, _mm_unpackhi_epi16(hi, zero));
+			}
+		}
+		#endif
+		for (; i < n; ++i)
+		{
+			w[i] = static_cast<Wide>(u[i]);
+		}
+	}
+
+	template <class Wide> std::size_t narrow(char* s, Wide const* w, std::size_t n)
+	// Length of the run of ASCII units at the front, copied into bytes
+	{
+		std::size_t i = 0;
+		#ifdef __SSE2__
+		auto const zero = _mm_setzero_si128();
+		for (; i + 16 <= n; i += 16)
+		{
+			auto const from = reinterpret_cast<__m128i const*>(w + i);
+			__m128i x;
+			if constexpr (2 == sizeof (Wide))
+			{
+				auto const a = _mm_loadu_si128(from);
+				auto const b = _mm_loadu_si128(from + 1);
+				auto const high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(~0x7F));
+				if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)))
+				{
+					break;
+				}
+				x = _mm_packus_epi16(a, b);
+			}
+			else
+			{
+				auto const a = _mm_loadu_si128(from);
+				auto const b = _mm_loadu_si128(from + 1);
+				auto const c = _mm_loadu_si128(from + 2);
+				auto const d = _mm_loadu_si128(from + 3);
+				auto const any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+				auto const high = _mm_and_si128(any, _mm_set1_epi32(~0x7F));
+				if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)))
+				{
+					break;
+				}
+				x = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(s + i), x);
+		}
+		#endif
+		for (; i < n and static_cast<char32_t>(w[i]) < 0x80; ++i)
+		{
+			s[i] = static_cast<char>(w[i]);
+		}
+		return i;
+	}
+
+	std::size_t step(byte const* u, std::size_t n, char32_t& x)
+	// Bytes in the sequence at the front, zero when malformed
+	{
+		std::size_t k = 0;
+		auto const c = u[0];
+		if (c < 0x80)
+		{
+			x = c;
+			return 1;
+		}
+		else
+		if (0xC2 <= c and c <= 0xDF)
+		{
+			x = c & 0x1F;
+			k = 2;
+		}
+		else
+		if (0xE0 <= c and c <= 0xEF)
+		{
+			x = c & 0x0F;
+			k = 3;
+		}
+		else
+		if (0xF0 <= c and c <= 0xF4)
+		{
+			x = c & 0x07;
+			k = 4;
+		}
+		if (0 == k or n < k)
+		{
+			return 0;
+		}
+		for (std::size_t j = 1; j < k; ++j)
+		{
+			if (0x80 != (u[j] & 0xC0))
+			{
+				return 0;
+			}
+			x = x << 6 | (u[j] & 0x3F);
+		}
+		// Overlong, surrogate and beyond the last plane
+		if (3 == k and (x < 0x800 or (0xD800 <= x and x <= 0xDFFF)))
+		{
+			return 0;
+		}
+		if (4 == k and (x < 0x10000 or 0x10FFFF < x))
+		{
+			return 0;
+		}
+		return k;
+	}
+
+	template <class Wide> std::size_t decode(Wide* w, char const* s, std::size_t n)
+	{
+		auto const u = reinterpret_cast<byte const*>(s);
+		std::size_t i = 0, j = 0;
+		while (i < n)
 		{
-			auto begin = s.data();
-			auto end = begin + s.size();
-			auto code = std::to_chars(begin, end, value, 0, precision);
-			if (std::errc::value_too_large == code.ec)
+			if (auto const k = ascii(u + i, n - i); 0 < k)
 			{
-				s.resize(2*s.size(), '\0');
+				widen(w + j, u + i, k);
+				i += k;
+				j += k;
 				continue;
 			}
-			s.resize(code.ptr - begin);
+
+			char32_t x;
+			auto k = step(u + i, n - i, x);
+			if (0 == k)
+			{
+				x = replacement;
+				k = 1;
+			}
+			i += k;
+
+			if constexpr (2 == sizeof (Wide))
+			{
+				if (0xFFFF < x)
+				{
+					x -= 0x10000;
+					w[j++] = static_cast<Wide>(0xD800 + (x >> 10));
+					w[j++] = static_cast<Wide>(0xDC00 + (x & 0x3FF));
+					continue;
+				}
+			}
+			w[j++] = static_cast<Wide>(x);
 		}
-		while (0);
-		s.shrink_to_fit();
-		return s;
-		*/
-		std::stringstream ss;
-		ss << std::fixed << std::setprecision(precision) << value;
-		return ss.str();
+		return j;
+	}
+
+	template <class Wide> std::size_t encode(char* s, Wide const* w, std::size_t n)
+	{
+		std::size_t i = 0, j = 0;
+		while (i < n)
+		{
+			if (auto const k = narrow(s + j, w + i, n - i); 0 < k)
+			{
+				i += k;
+				j += k;
+				continue;
+			}
+
+			auto x = static_cast<char32_t>(w[i++]);
+			if constexpr (2 == sizeof (Wide))
+			{
+				x &= 0xFFFF;
+				if (0xD800 <= x and x <= 0xDBFF and i < n)
+				{
+					auto const y = static_cast<char32_t>(w[i]) & 0xFFFF;
+					if (0xDC00 <= y and y <= 0xDFFF)
+					{
+						x = 0x10000 + ((x - 0xD800) << 10) + (y - 0xDC00);
+						++i;
+					}
+				}
+			}
+			if ((0xD800 <= x and x <= 0xDFFF) or 0x10FFFF < x)
+			{
+				x = replacement;
+			}
+
+			if (x < 0x800)
+			{
+				s[j++] = static_cast<char>(0xC0 | x >> 6);
+			}
+			else
+			{
+				if (x < 0x10000)
+				{
+					s[j++] = static_cast<char>(0xE0 | x >> 12);
+				}
+				else
+				{
+					s[j++] = static_cast<char>(0xF0 | x >> 18);
+					s[j++] = static_cast<char>(0x80 | (x >> 12 & 0x3F));
+				}
+				s[j++] = static_cast<char>(0x80 | (x >> 6 & 0x3F));
+			}
+			s[j++] = static_cast<char>(0x80 | (x & 0x3F));
+		}
+		return j;
 	}
 }
 
@@ -260,9 +761,175 @@ namespace fmt
 		return local;
 	}
 
+	template <class Char>
+	Char const* type<Char>::block(Char const* it, Char const* end, mask x, bool is)
+	{
+		if constexpr (std::is_same_v<Char, char>)
+		{
+			#ifdef __SSE2__
+			{
+				// Byte lanes for the masks with simple ranges
+				mask got { };
+				auto const has = [&got, x](mask m)
+				{
+					bool const all = m == (x & m);
+					if (all) got = static_cast<mask>(got | m);
+					return all;
+				};
+				bool const spaces = has(space), alphas = has(alpha);
+				bool const digits = has(digit), puncts = has(punct);
+
+				if (got == x)
+				{
+					auto const range = [](__m128i v, char low, char size)
+					{
+						auto const d = _mm_sub_epi8(v, _mm_set1_epi8(low));
+						auto const s = _mm_subs_epu8(d, _mm_set1_epi8(size));
+						return _mm_cmpeq_epi8(s, _mm_setzero_si128());
+					};
+
+					for (; 16 <= end - it; it += 16)
+					{
+						auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(it));
+						auto const letter = range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+						auto const number = range(v, '0', '9' - '0');
+						auto m = _mm_setzero_si128();
+						if (spaces)
+						{
+							m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+							m = _mm_or_si128(m, range(v, '\t', '\r' - '\t'));
+						}
+						if (alphas)
+						{
+							m = _mm_or_si128(m, letter);
+						}
+						if (digits)
+						{
+							m = _mm_or_si128(m, number);
+						}
+						if (puncts)
+						{
+							auto const graph = range(v, '!', '~' - '!');
+							auto const word = _mm_or_si128(letter, number);
+							m = _mm_or_si128(m, _mm_andnot_si128(word, graph));
+						}
+						auto bits = fmt::to<unsigned>(_mm_movemask_epi8(m));
+						if (not is)
+						{
+							bits ^= 0xFFFF;
+						}
+						if (0 != bits)
+						{
+							return it + std::countr_zero(bits);
+						}
+					}
+				}
+			}
+			#endif
+			while (it != end and is != (0 != (classes[static_cast<unsigned char>(*it)] & x)))
+			{
+				++it;
+			}
+			return it;
+		}
+		else
+		{
+			auto const& that = instance();
+			return is ? that.scan_is(x, it, end) : that.scan_not(x, it, end);
+		}
+	}
+
+	template <class Char>
+	typename type<Char>::size_type type<Char>::search(view u, view v, size_type pos)
+	{
+		if constexpr (std::is_same_v<Char, char>)
+		{
+			auto const end = u.data() + u.size();
+			auto const at = [&u](void const* ptr)
+			{
+				return nullptr == ptr ? npos : fmt::to_size(static_cast<char const*>(ptr) - u.data());
+			};
+
+			// Candidates by the first byte while it is rare
+			auto it = u.data() + pos;
+			for (int misses = 0; misses < 16; ++misses)
+			{
+				it = static_cast<char const*>(std::memchr(it, v.front(), fmt::to_size(end - it)));
+				if (nullptr == it or fmt::to_size(end - it) < v.size())
+				{
+					return npos;
+				}
+				if (0 == std::memcmp(it, v.data(), v.size()))
+				{
+					return at(it);
+				}
+				++it;
+			}
+
+			// Linear time when it is common
+			#ifdef _GNU_SOURCE
+			return at(memmem(it, fmt::to_size(end - it), v.data(), v.size()));
+			#else
+			return u.find(v, at(it));
+			#endif
+		}
+		else return u.find(v, pos);
+	}
+
 	template struct type<char>;
 	template struct type<wchar_t>;
 
+	std::size_t utf::check(char const* s, std::size_t n)
+	{
+		auto const u = reinterpret_cast<byte const*>(s);
+		std::size_t i = 0;
+		while (i < n)
+		{
+			i += ascii(u + i, n - i);
+			if (i < n)
+			{
+				char32_t x;
+				auto const k = step(u + i, n - i, x);
+				if (0 == k)
+				{
+					break;
+				}
+				i += k;
+			}
+		}
+		return i;
+	}
+
+	std::size_t utf::decode(char32_t* w, char const* s, std::size_t n)
+	{
+		return ::decode(w, s, n);
+	}
+
+	std::size_t utf::decode(char16_t* w, char const* s, std::size_t n)
+	{
+		return ::decode(w, s, n);
+	}
+
+	std::size_t utf::decode(wchar_t* w, char const* s, std::size_t n)
+	{
+		return ::decode(w, s, n);
+	}
+
+	std::size_t utf::encode(char* s, char32_t const* w, std::size_t n)
+	{
+		return ::encode(s, w, n);
+	}
+
+	std::size_t utf::encode(char* s, char16_t const* w, std::size_t n)
+	{
+		return ::encode(s, w, n);
+	}
+
+	std::size_t utf::encode(char* s, wchar_t const* w, std::size_t n)
+	{
+		return ::encode(s, w, n);
+	}
+
 	string to_string(long value, int base)
 	{
 		return from_base<long>(value, base);
@@ -298,6 +965,21 @@ namespace fmt
 		return from_fp<long double>(value, precision);
 	}
 
+	char* to_chars(char* begin, char* end, float value, int precision)
+	{
+		return from_fp<float>(begin, end, value, precision);
+	}
+
+	char* to_chars(char* begin, char* end, double value, int precision)
+	{
+		return from_fp<double>(begin, end, value, precision);
+	}
+
+	char* to_chars(char* begin, char* end, long double value, int precision)
+	{
+		return from_fp<long double>(begin, end, value, precision);
+	}
+
 	long to_long(string::view u, int base)
 	{
 		return to_base<long>(u, base);
@@ -336,6 +1018,26 @@ namespace fmt
 		return to_fp(u, nan, std::strtold);
 	}
 
+	size_t to_llong(string::view u, fwd::vector<long long>& out, int base)
+	{
+		return to_bulk(u, out, base);
+	}
+
+	size_t to_ullong(string::view u, fwd::vector<unsigned long long>& out, int base)
+	{
+		return to_bulk(u, out, base);
+	}
+
+	string::ref to_string(fwd::span<long long const> values, string::ref out, char separator, int base)
+	{
+		return from_bulk(values, out, separator, base);
+	}
+
+	string::ref to_string(fwd::span<unsigned long long const> values, string::ref out, char separator, int base)
+	{
+		return from_bulk(values, out, separator, base);
+	}
+
 	bool got(name n)
 	{
 		return strings::registry().got(n);
@@ -366,6 +1068,11 @@ namespace fmt
 		return strings::registry().set(n);
 	}
 
+	diff::vector set(view::span n)
+	{
+		return strings::registry().set(n);
+	}
+
 	string::in::ref get(string::in::ref in, char end)
 	{
 		return strings::registry().get(in, end);
@@ -390,6 +1097,40 @@ test_unit(dig)
 	assert(0.42f == fmt::to_float("0.42f"));
 	assert(std::isnan(fmt::to_float("nan")));
 	assert(std::isinf(fmt::to_double("inf")));
+	// Formatting
+	{
+		assert(fmt::to_string(2.5, 2) == "2.50");
+		assert(fmt::to_string(0.1f, -1) == "0.1");
+		assert(fmt::to_string(1e300, 0).size() == 301);
+
+		char buf[32];
+		auto const third = 1.0 / 3.0;
+		auto end = fmt::to_chars(buf, buf + sizeof buf, third);
+		assert(nullptr != end);
+		assert(third == fmt::to_double(fmt::string::view(buf, end - buf)));
+		end = fmt::to_chars(buf, buf + 2, third, 6);
+		assert(nullptr == end);
+	}
+	// Bulk integers
+	{
+		fwd::vector<long long> v;
+		fmt::string::view const text = "1, 22 333\n-4444;123456789012\t-9223372036854775807";
+		assert(6 == fmt::to_llong(text, v));
+		assert(v.at(2) == 333 and v.at(3) == -4444);
+		assert(v.at(4) == 123456789012);
+		assert(v.at(5) == -9223372036854775807);
+
+		fmt::string s;
+		fmt::to_string(fwd::span<long long const>(v.data(), 5), s, ',');
+		assert(s == "1,22,333,-4444,123456789012");
+
+		fwd::vector<unsigned long long> u;
+		assert(3 == fmt::to_ullong("ff 1A2b ffffffffffffffff", u, 16));
+		assert(u.at(0) == 0xFF and u.at(1) == 0x1A2B and u.at(2) == ~0ULL);
+		s.clear();
+		fmt::to_string(fwd::span<unsigned long long const>(u.data(), u.size()), s, ' ', 16);
+		assert(s == "ff 1a2b ffffffffffffffff");
+	}
 	// catch
 	//except(256 == (int) fmt::to_narrow<char>(256));
 	//except(-1 == (signed) fmt::to_unsigned(-1));
@@ -413,6 +1154,41 @@ test_unit(type)
 		assert('!' == *fmt::last(Filled));
 	}
 
+	// Class table and scanners agree with the classic locale
+	{
+		auto const& classic = std::use_facet<std::ctype<char>>(std::locale::classic());
+		auto const& that = fmt::type<char>::instance();
+		fmt::type<char>::mask const masks[] =
+		{
+			fmt::space, fmt::print, fmt::cntrl, fmt::upper, fmt::lower, fmt::alpha,
+			fmt::digit, fmt::punct, fmt::blank, fmt::alnum, fmt::graph, fmt::xdigit,
+		};
+
+		fmt::string all;
+		for (int c = 0; c < 256; ++c)
+		{
+			all += static_cast<char>(c);
+		}
+		for (auto const x : masks)
+		{
+			for (auto const c : all)
+			{
+				assert(classic.is(x, c) == that.check(c, x));
+			}
+		}
+
+		auto const text = all + " \t 42 words, and\tpunctuation!\r\n" + all;
+		auto const begin = text.data(), end = begin + text.size();
+		for (auto const x : masks)
+		{
+			for (auto it = begin; it != end; ++it)
+			{
+				assert(classic.scan_is(x, it, end) == that.next(it, end, x));
+				assert(classic.scan_not(x, it, end) == that.skip(it, end, x));
+			}
+		}
+	}
+
 	// Triming whitespace
 	{
 		assert(std::empty(fmt::trim(Space)));
@@ -437,6 +1213,29 @@ test_unit(type)
 		}
 	}
 
+	// Split lazily by a delimiter
+	{
+		auto const parts = [](fmt::string::view u, fmt::string::view v)
+		{
+			fmt::string::view::vector const t = fmt::split(u, v);
+			return fmt::join(t, "|");
+		};
+		assert(parts("a;b;;c", ";") == "a|b||c");
+		assert(parts(";a;", ";") == "|a");
+		assert(parts("", ";").empty());
+		assert(parts("a::b::", "::") == "a|b");
+		assert(parts("a:b", "::") == "a:b");
+		assert(parts("abc", "") == "abc");
+
+		size_t n = 0;
+		for (auto const u : fmt::split("x, y, z", ", "))
+		{
+			assert(1 == u.size());
+			++n;
+		}
+		assert(3 == n);
+	}
+
 	// String view null terminator
 	{
 		assert(fmt::terminated(Hello));
@@ -454,6 +1253,29 @@ test_unit(type)
 	{
 		assert(fmt::to_wstring(Hello) == Wide);
 		assert(fmt::to_string(Wide) == Hello);
+
+		fmt::string::view const Mixed = "Long enough for a block: caf\xC3\xA9 \xE2\x82\xAC \xF0\x9D\x84\x9E!";
+		auto const wide = fmt::to_wstring(Mixed);
+		assert(wide.find(L'\u00E9') != fmt::npos);
+		assert(wide.find(L'\u20AC') != fmt::npos);
+		assert(fmt::to_string(wide) == Mixed);
+		assert(fmt::utf::check(Mixed.data(), Mixed.size()) == Mixed.size());
+
+		char16_t pair[4];
+		fmt::string::view const Clef = "\xF0\x9D\x84\x9E";
+		assert(2 == fmt::utf::decode(pair, Clef.data(), Clef.size()));
+		assert(0xD834 == pair[0] and 0xDD1E == pair[1]);
+		char back[8];
+		assert(4 == fmt::utf::encode(back, pair, 2));
+		assert(Clef == fmt::string::view(back, 4));
+
+		// Overlong, truncated and surrogate forms
+		fmt::string::view const Bad = "a\xC0\xAF" "b\xE2\x82\xED\xA0\x80";
+		assert(1 == fmt::utf::check(Bad.data(), Bad.size()));
+		char32_t code[16];
+		auto const n = fmt::utf::decode(code, Bad.data(), Bad.size());
+		assert(9 == n and U'b' == code[3]);
+		assert(std::all_of(code + 4, code + n, [](char32_t x) { return 0xFFFD == x; }));
 	}
 
 	// Search matching braces
@@ -486,4 +1308,74 @@ test_unit(char)
 	}
 }
 
+test_unit(area)
+{
+	// Mixed scripts in a large buffer
+	fmt::string::view const sample =
+		"ASCII caf\xC3\xA9 \xD7\xA9\xD7\x9C\xD7\x95\xD7\x9D \xE0\xA4\xA8\xE0\xA4\xAE"
+		"\xE2\x80\x94 \xE4\xB8\xAD\xE6\x96\x87 \xED\x95\x9C \xF0\x9F\x98\x80 \xF0\xA0\x80\x80";
+	fmt::string text;
+	while (text.size() < (1 << 20))
+	{
+		text += sample;
+	}
+	fwd::vector<char32_t> points(text.size());
+	points.resize(fmt::utf::decode(points.data(), text.data(), text.size()));
+
+	// Same as walking every area in turn
+	constexpr auto none = static_cast<std::size_t>(fmt::area::none);
+	std::size_t counts[none + 1] = { };
+	for (auto const w : points)
+	{
+		auto const c = fmt::to<fmt::codepoint>(w);
+		auto const id = fmt::to_area(c);
+		++counts[static_cast<std::size_t>(id)];
+	}
+
+	auto const count = [&counts](fmt::area id)
+	{
+		return counts[static_cast<std::size_t>(id)];
+	};
+	assert(0 == count(fmt::area::none));
+	assert(0 < count(fmt::area::ACA));
+	assert(0 < count(fmt::area::RTL));
+	assert(0 < count(fmt::area::GSA));
+	assert(0 < count(fmt::area::PSA));
+	assert(0 < count(fmt::area::CJKV));
+	assert(0 < count(fmt::area::HSA));
+	assert(0 < count(fmt::area::SA));
+	assert(0 < count(fmt::area::SIP));
+
+	// Every code point as the interval chains of char.hpp place it
+	auto const chain = [](fmt::codepoint c)
+	{
+		using fmt::area;
+		if (fmt::ACA().any(c)) return area::ACA;
+		if (fmt::GSA().any(c)) return area::GSA;
+		if (fmt::RTL().any(c)) return area::RTL;
+		if (fmt::PSA().any(c)) return area::PSA;
+		if (fmt::SPA().any(c)) return area::SPA;
+		if (fmt::CJK().any(c)) return area::CJK;
+		if (fmt::CJKV().any(c)) return area::CJKV;
+		if (fmt::HSA().any(c)) return area::HSA;
+		if (fmt::SC().any(c)) return area::SC;
+		if (fmt::PUA().any(c)) return area::PUA;
+		if (fmt::CSA().any(c)) return area::CSA;
+		if (fmt::CHA().any(c)) return area::CHA;
+		if (fmt::ISA().any(c)) return area::ISA;
+		if (fmt::SA().any(c)) return area::SA;
+		if (fmt::SIP().any(c)) return area::SIP;
+		if (fmt::TIP().any(c)) return area::TIP;
+		if (fmt::UNP().any(c)) return area::UNP;
+		if (fmt::SSP().any(c)) return area::SSP;
+		return area::none;
+	};
+	std::size_t wrong = 0;
+	for (fmt::codepoint c = -1; c <= fmt::endpoint; ++c)
+	{
+		wrong += chain(c) != fmt::to_area(c);
+	}
+	assert(0 == wrong);
+}
+
 #endif
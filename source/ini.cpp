@@ -7,6 +7,15 @@
 #include "type.hpp"
 #include "dig.hpp"
 #include "err.hpp"
+#include "sys.hpp"
+#include "pipe.hpp"
+#include "mode.hpp"
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
 
 namespace
 {
@@ -16,6 +25,136 @@ namespace
 	}
 
 	constexpr auto separator = ";";
+
+	std::size_t mix(doc::ini::packed n)
+	// Fibonacci hashing of a packed name pair
+	{
+		n *= 0x9E3779B97F4A7C15;
+		return static_cast<std::size_t>(n ^ (n >> 32));
+	}
+
+	fmt::string::view strip(fmt::string::view u)
+	// Trim blanks without the locale
+	{
+		constexpr auto blank = " \t\r\v\f";
+		auto const i = u.find_first_not_of(blank);
+		if (fmt::npos == i)
+		{
+			return u.substr(u.size());
+		}
+		auto const j = u.find_last_not_of(blank);
+		return u.substr(i, j - i + 1);
+	}
+
+	// Compiled image layout: head, entries, table, then text
+
+	constexpr char magic[8] = { 'I', 'N', 'I', 'I', 'M', 'G', '0', '2' };
+
+	struct head
+	{
+		char magic[8];
+		std::uint64_t time;   // source modification in nanoseconds
+		std::uint64_t size;   // source length
+		std::uint64_t node;   // source inode
+		std::uint64_t device; // source file system
+		std::uint32_t count; // entries
+		std::uint32_t slots; // table, a power of two
+		std::uint64_t text;  // bytes of names and values
+	};
+
+	void stamp(head& h, sys::stat const& st)
+	// Source as it was so that an edit or a replaced file shows
+	{
+		#ifdef _WIN32
+		h.time = static_cast<std::uint64_t>(st.st_mtime) * 1000000000;
+		#else
+		h.time = static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1000000000
+			+ static_cast<std::uint64_t>(st.st_mtim.tv_nsec);
+		#endif
+		h.size = static_cast<std::uint64_t>(st.st_size);
+		h.node = static_cast<std::uint64_t>(st.st_ino);
+		h.device = static_cast<std::uint64_t>(st.st_dev);
+	}
+
+	struct entry
+	{
+		std::uint32_t group, group_size;
+		std::uint32_t key, key_size;
+		std::uint32_t value, value_size;
+	};
+
+	std::uint32_t hash(fmt::string::view group, fmt::string::view key)
+	// FNV-1a over both names so that ids need not survive the process
+	{
+		std::uint32_t n = 0x811C9DC5;
+		auto const step = [&n](char c)
+		{
+			n ^= static_cast<unsigned char>(c);
+			n *= 0x01000193;
+		};
+		for (char const c : group) step(c);
+		step('\0');
+		for (char const c : key) step(c);
+		return n;
+	}
+
+	bool fits(head const* h, std::size_t n)
+	// Whether every offset in an image of n bytes stays inside it
+	{
+		// Sizes taken away part by part so none can overflow
+		auto rest = n - sizeof (head);
+		if (rest / sizeof (entry) < h->count)
+		{
+			return false;
+		}
+		rest -= h->count * sizeof (entry);
+		if (rest / sizeof (std::uint32_t) < h->slots)
+		{
+			return false;
+		}
+		rest -= h->slots * sizeof (std::uint32_t);
+		if (rest != h->text)
+		{
+			return false;
+		}
+
+		auto const within = [h](std::uint32_t at, std::uint32_t sz)
+		{
+			return at <= h->text and sz <= h->text - at;
+		};
+		auto const entries = reinterpret_cast<entry const*>(h + 1);
+		for (std::uint32_t pos = 0; pos < h->count; ++pos)
+		{
+			auto const& e = entries[pos];
+			if (not within(e.group, e.group_size)
+				or not within(e.key, e.key_size)
+				or not within(e.value, e.value_size))
+			{
+				return false;
+			}
+		}
+
+		// Probes stop only at an empty slot so one must exist
+		bool empty = false;
+		auto const table = reinterpret_cast<std::uint32_t const*>(entries + h->count);
+		for (std::uint32_t i = 0; i < h->slots; ++i)
+		{
+			if (0 == table[i])
+			{
+				empty = true;
+			}
+			else if (h->count < table[i])
+			{
+				return false;
+			}
+		}
+		return empty;
+	}
+
+	fmt::string::view name(doc::path::type id)
+	{
+		return 0 == id ? fmt::string::view() : fmt::get(id);
+	}
 }
 
 namespace doc
@@ -60,54 +199,107 @@ namespace doc
 		return input;
 	}
 
-	ini::in::ref operator>>(ini::in::ref input, ini::ref output)
+	std::size_t ini::parse(view u)
 	{
-		path::type group = 0;
-		ini::string token;
+		struct token
+		{
+			std::size_t group, key;
+			view value;
+		};
+
+		fwd::vector<token> tokens;
+		vector names;
+		auto group = fmt::npos;
 
-		while (ini::getline(input, token))
+		// Tokenize in one pass
+		for (auto i = fmt::null, z = u.size(); i < z; )
 		{
-			// Check for new group
-			if (header(token))
+			auto j = u.find(fmt::eol, i);
+			if (fmt::npos == j)
+			{
+				j = z;
+			}
+			auto line = u.substr(i, j - i);
+			i = j + 1;
+
+			// Read past comment
+			constexpr char omit = '#';
+			line = strip(line.substr(0, line.find(omit)));
+			if (line.empty())
 			{
-				auto const z = token.size();
-				token = token.substr(1, z - 2);
-				group = fmt::set(token);
 				continue;
 			}
 
-			#ifdef trace
-			if (not fmt::got(group))
+			// Check for new group
+			if (header(line))
 			{
-				trace("no group");
+				group = names.size();
+				names.emplace_back(line.substr(1, line.size() - 2));
+				continue;
 			}
-			#endif
 
-			// Create key pair for value entry
-			auto const pair = fmt::to_pair(token);
-			auto const key = fmt::set(pair.first);
-			auto const value = pair.second;
-			if (value.empty())
+			auto const k = line.find('=');
+			if (fmt::npos == k)
 			{
-				break;
+				#ifdef trace
+				trace("no value", line);
+				#endif
+				continue;
 			}
 
-			// Create a new entry in the key table
-			if (not output.set({ group, key }, value))
+			tokens.push_back({ group, names.size(), strip(line.substr(k + 1)) });
+			names.emplace_back(strip(line.substr(0, k)));
+		}
+
+		// Intern all names under one lock
+		auto const ids = fmt::set(names);
+
+		for (auto const& t : tokens)
+		{
+			path::type const g = fmt::npos == t.group ? 0 : ids.at(t.group);
+			path::type const k = ids.at(t.key);
+			if (not put({ g, k }, t.value))
 			{
 				#ifdef trace
-				trace("overwrite", key, "with", value);
+				trace("overwrite", names.at(t.key), "with", t.value);
 				#endif
 			}
 		}
+		return tokens.size();
+	}
+
+	ini::in::ref operator>>(ini::in::ref input, ini::ref output)
+	{
+		// Own the whole text so that values may refer into it
+		std::istreambuf_iterator<char> const begin(input), end;
+		ini::string buf(begin, end);
+		if (buf.empty())
+		{
+			input.setstate(std::ios::failbit);
+		}
+		else
+		{
+			auto const it = output.cache.emplace(std::move(buf)).first;
+			(void) output.parse(*it);
+		}
+		input.setstate(std::ios::eofbit);
 		return input;
 	}
 
 	ini::out::ref operator<<(ini::out::ref output, ini::cref input)
 	{
+		// Sorted view of entries by group then key
+		fwd::vector<std::size_t> order(input.names.size());
+		std::iota(order.begin(), order.end(), fmt::null);
+		std::sort(order.begin(), order.end(), [&input](auto i, auto j)
+		{
+			return input.names.at(i) < input.names.at(j);
+		});
+
 		path::type last = -1;
-		for (auto [k, v] : input.keys)
+		for (auto const pos : order)
 		{
+			auto const k = ini::unpack(input.names.at(pos));
 			if (k.first != last)
 			{
 				last = k.first;
@@ -117,21 +309,80 @@ namespace doc
 			}
 
 			auto const key = fmt::get(k.second);
-			ini::view const value = input.values.at(v);
+			ini::view const value = input.values.at(pos);
 			output << key << "=" << value << fmt::eol;
 		}
 		return output;
 	}
 
+	ini::packed ini::pack(path::pair key)
+	// Both ids must fit in half or two keys would share a slot
+	{
+		auto const g = static_cast<std::uint32_t>(fmt::to<std::int32_t>(key.first));
+		auto const k = static_cast<std::uint32_t>(fmt::to<std::int32_t>(key.second));
+		return (packed(g) << 32) | k;
+	}
+
+	path::pair ini::unpack(packed n)
+	{
+		auto const g = static_cast<std::int32_t>(n >> 32);
+		auto const k = static_cast<std::int32_t>(n & 0xFFFFFFFF);
+		return { g, k };
+	}
+
+	std::size_t ini::find(path::pair key) const
+	{
+		if (table.empty())
+		{
+			return fmt::npos;
+		}
+
+		auto const n = pack(key);
+		auto const mask = table.size() - 1;
+		for (auto i = mix(n) & mask; ; i = (i + 1) & mask)
+		{
+			auto const at = table[i];
+			if (at < 0)
+			{
+				return fmt::npos;
+			}
+			auto const pos = fmt::to_size(at);
+			if (names[pos] == n)
+			{
+				return pos;
+			}
+		}
+	}
+
+	void ini::rehash(std::size_t size)
+	{
+		#ifdef assert
+		assert(0 == (size & (size - 1)));
+		assert(names.size() < size);
+		#endif
+
+		table.assign(size, -1);
+		auto const mask = size - 1;
+		for (auto pos = fmt::null; pos < names.size(); ++pos)
+		{
+			auto i = mix(names[pos]) & mask;
+			while (-1 < table[i])
+			{
+				i = (i + 1) & mask;
+			}
+			table[i] = fmt::to<path::type>(pos);
+		}
+	}
+
 	bool ini::got(path::pair key) const
 	{
-		return keys.find(key) != keys.end();
+		return fmt::npos != find(key);
 	}
 
 	ini::view ini::get(path::pair key) const
 	{
-		auto const it = keys.find(key);
-		return it == keys.end() ? "" : values.at(it->second);
+		auto const pos = find(key);
+		return fmt::npos == pos ? "" : values.at(pos);
 	}
 
 	bool ini::set(path::pair key, view value)
@@ -143,23 +394,270 @@ namespace doc
 
 	bool ini::put(path::pair key, view value)
 	{
-		auto const it = keys.find(key);
-		if (keys.end() == it)
+		if (auto const pos = find(key); fmt::npos != pos)
+		{
+			values[pos] = value;
+			return false;
+		}
+
+		names.push_back(pack(key));
+		values.emplace_back(value);
+
+		// Keep load factor at or below one half
+		if (table.size() < 2 * names.size())
 		{
-			auto const size = values.size();
-			values.emplace_back(value);
-			keys[key] = fmt::to<path::type>(size);
-			return true;
+			rehash(std::max<std::size_t>(16, 2 * table.size()));
 		}
 		else
 		{
-			values[it->second] = value;
-			return false;
+			auto const mask = table.size() - 1;
+			auto i = mix(names.back()) & mask;
+			while (-1 < table[i])
+			{
+				i = (i + 1) & mask;
+			}
+			table[i] = fmt::to<path::type>(names.size() - 1);
+		}
+		return true;
+	}
+
+	image::string image::where(view source)
+	{
+		return fmt::join({source, "bin"}, ".");
+	}
+
+	bool image::make(ini::cref input, view source)
+	{
+		auto const s = fmt::to_string(source);
+		struct sys::stat const st(s.c_str());
+		if (sys::fail(st))
+		{
+			return failure;
+		}
+
+		struct item
+		{
+			view group, key, value;
+		};
+
+		// Grouped as the text would be written
+		fwd::vector<item> items;
+		items.reserve(input.names.size());
+		for (auto pos = fmt::null; pos < input.names.size(); ++pos)
+		{
+			auto const k = ini::unpack(input.names[pos]);
+			items.push_back({ name(k.first), name(k.second), input.values[pos] });
+		}
+		std::sort(items.begin(), items.end(), [](auto const& a, auto const& b)
+		{
+			return a.group < b.group or (a.group == b.group and a.key < b.key);
+		});
+
+		head h { };
+		std::memcpy(h.magic, magic, sizeof magic);
+		stamp(h, st);
+		h.count = fmt::to<std::uint32_t>(items.size());
+		h.slots = 8;
+		while (h.slots < 2 * h.count)
+		{
+			h.slots <<= 1;
+		}
+
+		string text;
+		fwd::vector<entry> entries;
+		entries.reserve(items.size());
+		auto const add = [&text](view u, std::uint32_t& at, std::uint32_t& sz)
+		{
+			at = fmt::to<std::uint32_t>(text.size());
+			sz = fmt::to<std::uint32_t>(u.size());
+			text.append(u);
+		};
+
+		view group;
+		entry last { };
+		for (auto const& it : items)
+		{
+			entry e;
+			// Each group name is stored once
+			if (text.empty() or it.group != group)
+			{
+				group = it.group;
+				add(it.group, e.group, e.group_size);
+			}
+			else
+			{
+				e.group = last.group;
+				e.group_size = last.group_size;
+			}
+			add(it.key, e.key, e.key_size);
+			add(it.value, e.value, e.value_size);
+			entries.push_back(last = e);
+		}
+		h.text = text.size();
+
+		// Positions plus one so that zero marks an empty slot
+		fwd::vector<std::uint32_t> table(h.slots, 0);
+		auto const mask = h.slots - 1;
+		for (auto pos = fmt::null; pos < items.size(); ++pos)
+		{
+			auto i = hash(items[pos].group, items[pos].key) & mask;
+			while (0 != table[i])
+			{
+				i = (i + 1) & mask;
+			}
+			table[i] = fmt::to<std::uint32_t>(pos + 1);
+		}
+
+		auto const bytes = [](auto const* ptr, std::size_t n)
+		{
+			return view(reinterpret_cast<char const*>(ptr), n * sizeof *ptr);
+		};
+		// Replace the old image whole so readers never see a part
+		return env::file::replace(where(source),
+		{
+			bytes(&h, 1),
+			bytes(entries.data(), entries.size()),
+			bytes(table.data(), table.size()),
+			view(text),
+		});
+	}
+
+	bool image::open(view source)
+	{
+		map.reset();
+		size = 0;
+
+		auto const s = fmt::to_string(source);
+		struct sys::stat const st(s.c_str());
+		if (sys::fail(st))
+		{
+			return failure;
+		}
+
+		std::size_t n = 0;
+		auto ptr = env::file::open_map(where(source), &n);
+		if (nullptr == ptr or n < sizeof (head))
+		{
+			return failure;
+		}
+
+		// Stale, foreign or damaged images are ignored for the text
+		head now { };
+		stamp(now, st);
+		auto const h = static_cast<head const*>(ptr.get());
+		if (std::memcmp(h->magic, magic, sizeof magic)
+			or h->time != now.time
+			or h->size != now.size
+			or h->node != now.node
+			or h->device != now.device
+			or 0 == h->slots or 0 != (h->slots & (h->slots - 1))
+			or not fits(h, n))
+		{
+			return failure;
+		}
+
+		map = std::move(ptr);
+		size = n;
+		return success;
+	}
+
+	image::view image::text(std::uint32_t at, std::uint32_t sz) const
+	{
+		auto const h = static_cast<head const*>(map.get());
+		auto const base = reinterpret_cast<char const*>(h + 1)
+			+ h->count * sizeof (entry) + h->slots * sizeof (std::uint32_t);
+		return view(base + at, sz);
+	}
+
+	std::size_t image::find(view group, view key) const
+	{
+		if (0 == size)
+		{
+			return fmt::npos;
+		}
+
+		auto const h = static_cast<head const*>(map.get());
+		auto const entries = reinterpret_cast<entry const*>(h + 1);
+		auto const table = reinterpret_cast<std::uint32_t const*>(entries + h->count);
+		auto const mask = h->slots - 1;
+		for (auto i = hash(group, key) & mask; ; i = (i + 1) & mask)
+		{
+			auto const at = table[i];
+			if (0 == at)
+			{
+				return fmt::npos;
+			}
+			auto const& e = entries[at - 1];
+			if (text(e.key, e.key_size) == key and text(e.group, e.group_size) == group)
+			{
+				return at - 1;
+			}
+		}
+	}
+
+	std::size_t image::find(path::pair key) const
+	{
+		return find(name(key.first), name(key.second));
+	}
+
+	bool image::got(path::pair key) const
+	{
+		return fmt::npos != find(key);
+	}
+
+	image::view image::get(path::pair key) const
+	{
+		auto const pos = find(key);
+		return fmt::npos == pos ? "" : get(pos);
+	}
+
+	image::view image::get(std::size_t pos) const
+	{
+		#ifdef assert
+		assert(pos < count());
+		#endif
+		auto const h = static_cast<head const*>(map.get());
+		auto const& e = reinterpret_cast<entry const*>(h + 1)[pos];
+		return text(e.value, e.value_size);
+	}
+
+	std::size_t image::count() const
+	{
+		return 0 == size ? 0 : static_cast<head const*>(map.get())->count;
+	}
+
+	image::out::ref operator<<(image::out::ref output, image const& input)
+	{
+		if (0 == input.size)
+		{
+			return output;
 		}
+
+		auto const h = static_cast<head const*>(input.map.get());
+		auto const entries = reinterpret_cast<entry const*>(h + 1);
+		image::view last;
+		for (std::uint32_t pos = 0; pos < h->count; ++pos)
+		{
+			auto const& e = entries[pos];
+			auto const group = input.text(e.group, e.group_size);
+			if (0 == pos or group != last)
+			{
+				last = group;
+				output << '[' << group << ']' << fmt::eol;
+			}
+			auto const key = input.text(e.key, e.key_size);
+			auto const value = input.text(e.value, e.value_size);
+			output << key << "=" << value << fmt::eol;
+		}
+		return output;
 	}
 }
 
 #ifdef test_unit
+#include "dir.hpp"
+#include "env.hpp"
+#include <thread>
+
 test_unit(ini)
 {
 	doc::ini init;
@@ -177,6 +675,123 @@ test_unit(ini)
 		assert(value.find("/D_NMAKE") != fmt::npos);
 	}*/
 
+	// Data from buffer
+	{
+		fmt::string::view const text =
+			"# comment\n"
+			"[Buffer]\n"
+			"Key = Value # note\r\n"
+			"Empty=\n";
+
+		doc::ini buf;
+		assert(2 == buf.parse(text));
+
+		auto const group = fmt::set("Buffer");
+		auto const u = buf.get({group, fmt::set("Key")});
+		assert(u == "Value");
+		// Refers into the buffer without a copy
+		assert(text.data() < u.data() and u.data() < text.data() + text.size());
+		assert(buf.got({group, fmt::set("Empty")}));
+		assert(not buf.got({group, fmt::set("Missing")}));
+	}
+
+	// Index grows past its first table
+	{
+		doc::ini big;
+		auto const group = fmt::set("Index");
+		for (auto n : { 1, 2, 3, 5, 8, 13, 21, 34, 55, 89 })
+		{
+			auto const key = fmt::set(fmt::to_string(n));
+			assert(big.put({group, key}, "value"));
+		}
+		assert(big.got({group, fmt::set("89")}));
+		assert(not big.got({group, fmt::set("4")}));
+
+		doc::path::pair const pair { -7, 5 };
+		assert(doc::ini::unpack(doc::ini::pack(pair)) == pair);
+	}
+
+	// Batch and single names from two threads at once
+	{
+		fmt::string::vector text;
+		for (int n = 0; n < 200; ++n)
+		{
+			text.push_back("Thread" + fmt::to_string(n));
+		}
+		fmt::view::vector names(text.begin(), text.end());
+		fmt::diff::vector batch;
+		std::thread other([&]
+		{
+			batch = fmt::set(fmt::view::span(names));
+		});
+		for (auto it = names.rbegin(); it != names.rend(); ++it)
+		{
+			(void) fmt::set(*it);
+		}
+		other.join();
+		for (std::size_t n = 0; n < names.size(); ++n)
+		{
+			assert(batch.at(n) == fmt::set(names.at(n)));
+		}
+	}
+
+	// Compiled image
+	{
+		auto const path = fmt::dir::join({env::temp(), "image.ini"});
+		{
+			std::ofstream output(path);
+			output << "[Image]" << fmt::eol << "Key=Value" << fmt::eol;
+		}
+		doc::ini text;
+		{
+			std::ifstream input(path);
+			input >> text;
+		}
+		assert(success == doc::image::make(text, path));
+
+		doc::image bin;
+		assert(success == bin.open(path));
+		auto const group = fmt::set("Image");
+		assert(bin.get({group, fmt::set("Key")}) == "Value");
+		assert(not bin.got({group, fmt::set("Missing")}));
+
+		// Damaged once a key points past the text
+		auto const cache = doc::image::where(path);
+		{
+			std::fstream output(cache, std::ios::in | std::ios::out | std::ios::binary);
+			std::uint32_t const far = ~0u;
+			output.seekp(sizeof (head) + offsetof(entry, key));
+			output.write(reinterpret_cast<char const*>(&far), sizeof far);
+		}
+		assert(failure == bin.open(path));
+		assert(success == doc::image::make(text, path));
+		assert(success == bin.open(path));
+
+		// Stale once the source is replaced, even at the same size
+		{
+			auto const next = fmt::join({path, "new"}, ".");
+			{
+				std::ofstream output(next);
+				output << "[Image]" << fmt::eol << "Key=Other" << fmt::eol;
+			}
+			assert(0 == std::rename(next.c_str(), path.c_str()));
+		}
+		assert(failure == bin.open(path));
+		assert(success == doc::image::make(text, path));
+		assert(success == bin.open(path));
+
+		// Stale once the source changes size
+		{
+			std::ofstream output(path, std::ios::app);
+			output << "Other=Value" << fmt::eol;
+		}
+		assert(failure == bin.open(path));
+		assert(not bin.got({group, fmt::set("Key")}));
+
+		(void) std::remove(cache.c_str());
+		(void) std::remove(path.c_str());
+	}
+
 	// Data at runtime
 	{
 		auto const group = fmt::set("Group");
@@ -5,11 +5,25 @@
 #include "arg.hpp"
 #include "ini.hpp"
 #include "dir.hpp"
+#include "file.hpp"
 #include "str.hpp"
 #include "fmt.hpp"
 #include "dig.hpp"
 #include "type.hpp"
 #include "sync.hpp"
+#include "sys.hpp"
+#include "err.hpp"
+#include <functional>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <map>
+#include <set>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 namespace
 {
@@ -32,30 +46,281 @@ namespace
 		return fmt::join({env::opt::program(), "ini"}, ".");
 	}
 
-	auto& registry()
+	std::atomic<std::size_t> generation;
+	// Bumped after each table is published
+
+	struct parsed
+	// Value of one entry as each getter reads it, filled on first use
+	{
+		std::atomic<unsigned> ready { 0 };
+		std::atomic<long> number { 0 };
+		std::atomic<float> real { 0 };
+		std::atomic<bool> flag { false };
+
+		template <class Type> auto& slot()
+		{
+			if constexpr (std::is_same_v<Type, bool>) return flag;
+			else if constexpr (std::is_same_v<Type, long>) return number;
+			else return real;
+		}
+
+		template <class Type> static constexpr unsigned bit()
+		{
+			if constexpr (std::is_same_v<Type, bool>) return 1;
+			else if constexpr (std::is_same_v<Type, long>) return 2;
+			else return 4;
+		}
+
+		void copy(parsed const& that)
+		// Bits read first so the values they cover are filled
+		{
+			auto const bits = that.ready.load(std::memory_order_acquire);
+			number.store(that.number.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			real.store(that.real.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			flag.store(that.flag.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			ready.store(bits, std::memory_order_relaxed);
+		}
+	};
+
+	struct sheet : doc::ini
+	// Table of options with a parse beside each entry
+	{
+		std::unique_ptr<parsed[]> parse;
+		// Made again at each publish, kept only where the value is the same
+		fwd::vector<std::shared_ptr<fmt::string const>> blocks;
+		// Text of the values, shared with the tables before and after
+	};
+
+	class options : fwd::unique
+	// Readers pin the published table, writers copy it then publish
 	{
-		static sys::exclusive<doc::ini> ini;
-		// try read
+		sys::mutex key;
+		std::shared_ptr<sheet const> current;
+		// Guarded by key, old tables and their text go when no thread pins them
+
+		void own(sheet& next) const
+		// Copy new values into one block and share the old blocks still in use
 		{
-			auto const reader = ini.read();
-			if (not empty(reader->keys))
+			auto const& last = *current;
+			std::map<char const*, std::size_t> start;
+			for (auto n = fmt::null; n < last.blocks.size(); ++n)
 			{
-				return ini;
+				start.emplace(last.blocks[n]->data(), n);
 			}
+
+			// Which block of the last table each value is in, if any
+			auto const size = next.values.size();
+			fwd::vector<std::size_t> where(size, fmt::npos);
+			fwd::vector<std::size_t> live(last.blocks.size(), 0);
+			for (auto pos = fmt::null; pos < size; ++pos)
+			{
+				auto const v = next.values[pos];
+				auto it = start.upper_bound(v.data());
+				if (empty(v) or start.begin() == it)
+				{
+					continue;
+				}
+				auto const& block = *last.blocks[(--it)->second];
+				if (std::less_equal<>()(v.data() + v.size(), block.data() + block.size()))
+				{
+					where[pos] = it->second;
+					live[it->second] += v.size();
+				}
+			}
+
+			// Blocks less than half in use are copied out and let go
+			auto const sparse = [&](std::size_t n)
+			{
+				return 2 * live[n] < last.blocks[n]->size();
+			};
+			auto const moved = [&](std::size_t pos)
+			{
+				return not empty(next.values[pos]) and (fmt::npos == where[pos] or sparse(where[pos]));
+			};
+			for (auto n = fmt::null; n < last.blocks.size(); ++n)
+			{
+				if (not sparse(n))
+				{
+					next.blocks.push_back(last.blocks[n]);
+				}
+			}
+
+			std::size_t bytes = 0;
+			for (auto pos = fmt::null; pos < size; ++pos)
+			{
+				bytes += moved(pos) ? next.values[pos].size() : 0;
+			}
+			if (0 < bytes)
+			{
+				auto block = std::make_shared<fmt::string>();
+				block->reserve(bytes);
+				for (auto pos = fmt::null; pos < size; ++pos)
+				{
+					if (moved(pos))
+					{
+						auto& v = next.values[pos];
+						auto const at = block->size();
+						block->append(v);
+						v = doc::ini::view(block->data() + at, v.size());
+					}
+				}
+				next.blocks.push_back(std::move(block));
+			}
+			next.cache.clear();
+		}
+
+		void parse(sheet& next) const
+		// Keep what readers parsed of the entries this writer left alone
+		{
+			auto const& last = *current;
+			auto const size = next.values.size();
+			next.parse = std::make_unique<parsed[]>(size);
+			for (auto pos = fmt::null; pos < size and pos < last.values.size(); ++pos)
+			{
+				auto const& u = last.values[pos];
+				auto const& v = next.values[pos];
+				if (u.data() == v.data() and u.size() == v.size())
+				{
+					next.parse[pos].copy(last.parse[pos]);
+				}
+			}
+		}
+
+	public:
+
+		options() : current(std::make_shared<sheet const>())
+		{ }
+
+		auto const& read()
+		// Pinned until this thread reads again after a newer table
+		{
+			thread_local struct
+			{
+				std::shared_ptr<sheet const> ptr;
+				std::size_t seen = 0;
+			} pin;
+
+			auto const now = generation.load(std::memory_order_acquire);
+			if (nullptr == pin.ptr or now != pin.seen)
+			{
+				auto const unlock = key.lock();
+				pin.ptr = current;
+				pin.seen = generation.load(std::memory_order_relaxed);
+			}
+			return pin.ptr;
+		}
+
+		auto write()
+		{
+			using writer = decltype(key.lock());
+			class publish : fwd::unique
+			{
+				writer const lock;
+				options* that;
+				std::shared_ptr<sheet> next;
+
+			public:
+
+				publish(options* ptr)
+				: lock(ptr->key.lock())
+				, that(ptr)
+				, next(std::make_shared<sheet>())
+				{
+					doc::ini::ref slice = *next;
+					slice = *that->current;
+				}
+
+				~publish()
+				{
+					that->own(*next);
+					that->parse(*next);
+					that->current = std::move(next);
+					generation.fetch_add(1, std::memory_order_release);
+				}
+
+				bool set(doc::path::pair key, fmt::string::view value)
+				// Copy of value kept for as long as a table refers to it
+				{
+					return next->set(key, value);
+				}
+
+				doc::ini::ref operator*()
+				{
+					return *next;
+				}
+
+				doc::ini* operator->()
+				{
+					return next.get();
+				}
+			};
+			return publish(this);
 		}
-		// next write
+	};
+
+	auto& compiled()
+	// Image of the initials file, read only once mapped
+	{
+		static doc::image bin;
+		return bin;
+	}
+
+	auto& precast()
+	// Parse beside each image entry, which cannot change once mapped
+	{
+		static std::unique_ptr<parsed[]> parse;
+		return parse;
+	}
+
+	auto& registry()
+	{
+		static options ini;
+		static std::once_flag once;
+		std::call_once(once, []
 		{
 			auto writer = ini.write();
 			auto const path = env::opt::initials();
-			auto const s = fmt::to_string(path);
 			doc::ini::ref slice = *writer;
 			slice.set(make_pair(), env::opt::program());
-			std::ifstream input(s);
-			while (input >> slice);
-			return ini;
-		}
+			// Parse the text only when its image is missing or stale
+			if (compiled().open(path))
+			{
+				auto const s = fmt::to_string(path);
+				std::ifstream input(s);
+				while (input >> slice);
+				(void) doc::image::make(slice, path);
+			}
+			else
+			{
+				precast() = std::make_unique<parsed[]>(compiled().count());
+			}
+		});
+		return ini;
+	}
+
+	auto parse(fmt::string const& path)
+	{
+		auto const ptr = std::make_shared<doc::ini>();
+		std::ifstream input(path);
+		while (input >> *ptr);
+		return ptr;
 	}
 
+	struct watcher : fwd::unique
+	// Directories under inotify and the last parse of each file
+	{
+		sys::mutex key;
+		int fd = env::file::invalid;
+		std::map<int, fmt::string> dirs;
+		std::map<fmt::string, std::shared_ptr<doc::ini>> files;
+
+		static auto& self()
+		{
+			static watcher singleton;
+			return singleton;
+		}
+	};
+
 	auto find_next(fmt::string::view argu, env::opt::command::span cmd)
 	{
 		auto const begin = cmd.begin();
@@ -89,14 +354,111 @@ namespace
 		return next;
 	}
 
-	template
-	<
-		class Key, class Value, class Cast
-	>
-	auto cast(Key key, Value value, Cast cast)
+	bool outside(env::opt::name key, fmt::string::view& value)
+	// Arguments then environment, which both change without a publish
+	{
+		auto const u = fmt::get(key);
+		for (auto const a : env::opt::arguments())
+		{
+			auto const e = fmt::to_pair(a);
+			if (e.first == u)
+			{
+				value = e.second;
+				return true;
+			}
+		}
+		value = env::var::get(u);
+		return not empty(value);
+	}
+
+	template <class Value>
+	bool cached(parsed& entry, Value& value)
+	{
+		auto& slot = entry.template slot<Value>();
+		constexpr auto bit = parsed::bit<Value>();
+		if (bit & entry.ready.load(std::memory_order_acquire))
+		{
+			value = slot.load(std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+	template <class Value>
+	Value cache(parsed& entry, Value value)
+	// Racing readers store the same value
+	{
+		entry.template slot<Value>().store(value, std::memory_order_relaxed);
+		entry.ready.fetch_or(parsed::bit<Value>(), std::memory_order_release);
+		return value;
+	}
+
+	template <class Value, class Cast>
+	Value memo(env::opt::pair key, Value value, Cast cast, bool keep)
+	// Parse of an entry lives beside it until a writer changes it
+	{
+		auto const& reader = registry().read();
+		if (auto const pos = reader->find(key); fmt::npos != pos)
+		{
+			auto const u = reader->values[pos];
+			if (empty(u))
+			{
+				return value;
+			}
+			if (not keep)
+			{
+				return cast(u);
+			}
+
+			auto& entry = reader->parse[pos];
+			if (cached(entry, value))
+			{
+				return value;
+			}
+			// Parsing may read options and move the pin
+			auto const hold = reader;
+			return cache<Value>(entry, cast(u));
+		}
+
+		// Entries of the image stay until the process ends
+		auto const& bin = compiled();
+		auto const pos = bin.find(key);
+		if (fmt::npos == pos)
+		{
+			return value;
+		}
+		auto const u = bin.get(pos);
+		if (empty(u))
+		{
+			return value;
+		}
+		if (not keep)
+		{
+			return cast(u);
+		}
+
+		auto& entry = precast()[pos];
+		if (cached(entry, value))
+		{
+			return value;
+		}
+		return cache<Value>(entry, cast(u));
+	}
+
+	template <class Value, class Cast>
+	auto cast(env::opt::pair key, Value value, Cast cast, bool keep = true)
+	{
+		return memo(key, value, cast, keep);
+	}
+
+	template <class Value, class Cast>
+	auto cast(env::opt::name key, Value value, Cast cast, bool keep = true)
 	{
-		auto const u = env::opt::get(key);
-		return empty(u) ? value : cast(u);
+		if (fmt::string::view u; outside(key, u))
+		{
+			return empty(u) ? value : cast(u);
+		}
+		return memo(make_pair(key), value, cast, keep);
 	}
 
 	auto cast(bool value)
@@ -106,10 +468,9 @@ namespace
 
 	template <class Key> bool cast(Key key, bool value)
 	{
-		auto const check = { cast(false), "0", "no", "off", "disable" };
-		auto const u = env::opt::get(key);
-		if (not empty(u))
+		return cast(key, value, [](auto u)
 		{
+			auto const check = { cast(false), "0", "no", "off", "disable" };
 			auto const s = fmt::to_lower(u);
 			for (auto const v : check)
 			{
@@ -119,8 +480,7 @@ namespace
 				}
 			}
 			return true;
-		}
-		return value;
+		});
 	}
 
 }
@@ -166,7 +526,7 @@ namespace env::opt
 		return cast(key, value, [base](auto value)
 		{
 			return fmt::to_long(value, base);
-		});
+		}, 10 == base);
 	}
 
 	bool set(name key, long value, int base)
@@ -179,7 +539,7 @@ namespace env::opt
 		return cast(key, value, [base](auto value)
 		{
 			return fmt::to_long(value, base);
-		});
+		}, 10 == base);
 	}
 
 	bool set(pair key, long value, int base)
@@ -208,9 +568,14 @@ namespace env::opt
 		});
 	}
 
-	bool set(pair key, float value)
+	bool set(pair key, float value, int digits)
 	{
-		return set(key, fmt::to_string(value));
+		return set(key, fmt::to_string(value, digits));
+	}
+
+	std::size_t version()
+	{
+		return generation.load(std::memory_order_acquire);
 	}
 
 	// arg.hpp
@@ -273,6 +638,165 @@ namespace env::opt
 		return s;
 	}
 
+	bool watch(view path)
+	{
+		#ifdef __linux__
+		{
+			if (empty(path))
+			{
+				return failure;
+			}
+
+			auto& w = watcher::self();
+			auto const unlock = w.key.lock();
+
+			if (env::file::fail(w.fd))
+			{
+				w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+				if (env::file::fail(w.fd))
+				{
+					sys::err(here, "inotify_init1");
+					return failure;
+				}
+			}
+
+			// Watch the directory so that replaced files are seen
+			auto folders = fmt::dir::split(path);
+			auto const name = folders.back();
+			folders.pop_back();
+			auto dir = fmt::dir::join(folders);
+			if (empty(dir) and not path.starts_with(sys::sep::dir))
+			{
+				dir = ".";
+			}
+			else
+			if (empty(dir))
+			{
+				dir = sys::sep::dir;
+			}
+
+			auto const wd = inotify_add_watch(w.fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (env::file::fail(wd))
+			{
+				sys::err(here, "inotify_add_watch", dir);
+				return failure;
+			}
+
+			auto const s = fmt::dir::join({dir, name});
+			auto const& file = *(w.files[s] = parse(s));
+			w.dirs[wd] = std::move(dir);
+
+			// Keys of the file take effect now, not at its first change
+			if (not empty(file.names))
+			{
+				auto writer = registry().write();
+				for (auto pos = fmt::null; pos < file.names.size(); ++pos)
+				{
+					(void) writer.set(doc::ini::unpack(file.names[pos]), file.values[pos]);
+				}
+			}
+			return success;
+		}
+		#else
+		{
+			(void) path;
+			return failure;
+		}
+		#endif
+	}
+
+	std::size_t reload()
+	{
+		std::size_t count = 0;
+
+		#ifdef __linux__
+		{
+			auto& w = watcher::self();
+			auto const unlock = w.key.lock();
+
+			if (env::file::fail(w.fd))
+			{
+				return count;
+			}
+
+			// Drain pending events without blocking
+			std::set<fmt::string> changed;
+			alignas(inotify_event) char buf[BUFSIZ];
+			while (true)
+			{
+				auto const n = sys::read(w.fd, buf, sizeof buf);
+				if (n <= 0)
+				{
+					if (n < 0 and EAGAIN != errno)
+					{
+						sys::err(here, "read", w.fd);
+					}
+					break;
+				}
+
+				for (auto p = buf; p < buf + n; )
+				{
+					auto const ev = reinterpret_cast<inotify_event const*>(p);
+					p += sizeof(inotify_event) + ev->len;
+
+					if (0 < ev->len)
+					{
+						auto const it = w.dirs.find(ev->wd);
+						if (w.dirs.end() != it)
+						{
+							auto const s = fmt::dir::join({it->second, ev->name});
+							if (w.files.count(s))
+							{
+								changed.insert(s);
+							}
+						}
+					}
+				}
+			}
+
+			// Re-parse only the modified files
+			for (auto const& path : changed)
+			{
+				auto const next = parse(path);
+				auto& last = w.files[path];
+
+				fwd::vector<std::pair<doc::path::pair, view>> diff;
+				for (auto pos = fmt::null; pos < next->names.size(); ++pos)
+				{
+					auto const key = doc::ini::unpack(next->names.at(pos));
+					auto const value = next->values.at(pos);
+					if (not last->got(key) or last->get(key) != value)
+					{
+						diff.emplace_back(key, value);
+					}
+				}
+				for (auto const n : last->names)
+				{
+					auto const key = doc::ini::unpack(n);
+					if (not next->got(key))
+					{
+						diff.emplace_back(key, fmt::empty);
+					}
+				}
+
+				if (not empty(diff))
+				{
+					// Publish all keys of one file at once
+					auto writer = registry().write();
+					for (auto const& [key, value] : diff)
+					{
+						(void) writer.set(key, value);
+					}
+					count += diff.size();
+				}
+				last = next;
+			}
+		}
+		#endif
+
+		return count;
+	}
+
 	fmt::string::in::ref get(fmt::string::in::ref in)
 	{
 		auto writer = registry().write();
@@ -284,22 +808,24 @@ namespace env::opt
 	{
 		auto const reader = registry().read();
 		doc::ini::cref slice = *reader;
-		return out << slice;
+		// Later entries override the image when read back
+		return out << compiled() << slice;
 	}
 
 	bool got(pair key)
 	{
-		return registry().read()->got(key);
+		return registry().read()->got(key) or compiled().got(key);
 	}
 
 	view get(pair key)
 	{
-		return registry().read()->get(key);
+		auto const& reader = registry().read();
+		return reader->got(key) ? reader->get(key) : compiled().get(key);
 	}
 
 	bool set(pair key, view value)
 	{
-		return registry().write()->set(key, value);
+		return registry().write().set(key, value);
 	}
 
 	bool got(name key)
@@ -309,25 +835,13 @@ namespace env::opt
 
 	view get(name key)
 	{
-		auto const u = fmt::get(key);
-		// First look for argument
-		auto const args = arguments();
-		for (auto const a : args)
-		{
-			auto const e = fmt::to_pair(a);
-			if (e.first == u)
-			{
-				return e.second;
-			}
-		}
-		// Second look in environment
-		auto value = env::var::get(u);
-		if (empty(value))
+		// First arguments then environment
+		if (view value; outside(key, value))
 		{
-			// Finally look in options table
-			value = env::opt::get(make_pair(key));
+			return value;
 		}
-		return value;
+		// Finally look in options table
+		return env::opt::get(make_pair(key));
 	}
 
 	bool set(name key, fmt::string::view value)
@@ -343,6 +857,8 @@ namespace env::opt
 		// Arguments not part of a command
 		fmt::string::view::vector extra;
 		fmt::string::view::vector args;
+		// Options published together at the end
+		fwd::vector<std::pair<pair, fmt::string>> found;
 		// Command line range
 		auto const end = cmd.end();
 		auto current = end;
@@ -357,7 +873,7 @@ namespace env::opt
 				// Set as option
 				auto const key = fmt::set(next->name);
 				current = 0 < next->argn ? next : end;
-				env::opt::set(key, true);
+				found.emplace_back(make_pair(key), cast(true));
 				args.clear();
 			}
 			else
@@ -370,7 +886,7 @@ namespace env::opt
 					args.emplace_back(argu);
 					auto const value = doc::ini::join(args);
 					auto const key = fmt::set(current->name);
-					(void) set(key, value);
+					found.emplace_back(make_pair(key), value);
 				}
 				else
 				{
@@ -384,6 +900,16 @@ namespace env::opt
 				extra.emplace_back(argu);
 			}
 		}
+
+		if (not empty(found))
+		{
+			// One table for the whole command line
+			auto writer = registry().write();
+			for (auto const& [key, value] : found)
+			{
+				(void) writer.set(key, value);
+			}
+		}
 		return extra;
 	}
 }
@@ -405,5 +931,81 @@ test_unit(arg)
 		auto const s = ss.str();
 		assert(not empty(s) and "Cannot dump options");
 	}
+	// Typed handle follows set
+	{
+		auto const key = std::make_pair(fmt::set("Handle"), fmt::set("Count"));
+		env::opt::handle<long> count(key, 0);
+		assert(0 == count());
+		(void) env::opt::set(key, 42L);
+		assert(42 == count());
+		assert(42 == env::opt::get(key, 0L));
+		(void) env::opt::set(key, 7L);
+		assert(7 == count());
+
+		// Views stay valid until this thread reads a newer table
+		auto const u = env::opt::get(key, fmt::empty);
+		for (long n = 0; n < 100; ++n)
+		{
+			(void) env::opt::set(key, n);
+		}
+		assert(u == "7" and 99 == count());
+	}
+	// Values stay right as the blocks under them are let go
+	{
+		auto const group = fmt::set("Compact");
+		fmt::string::stream ss;
+		ss << "[Compact]" << fmt::eol;
+		for (long n = 0; n < 16; ++n)
+		{
+			ss << n << '=' << n << fmt::eol;
+		}
+		(void) env::opt::get(ss);
+		for (long n = 1; n < 16; ++n)
+		{
+			auto const key = std::make_pair(group, fmt::set(std::to_string(n)));
+			(void) env::opt::set(key, n + 16);
+		}
+		assert(0 == env::opt::get(std::make_pair(group, fmt::set("0")), -1L));
+		for (long n = 1; n < 16; ++n)
+		{
+			auto const key = std::make_pair(group, fmt::set(std::to_string(n)));
+			assert(n + 16 == env::opt::get(key, -1L));
+		}
+	}
+	// Environment is read afresh over the parsed table
+	{
+		auto const key = fmt::set("OPT_TEST_LEVEL");
+		(void) env::opt::set(key, 3L);
+		assert(3 == env::opt::get(key, 0L));
+		assert(3 == env::opt::get(key, 0L));
+		(void) env::var::put("OPT_TEST_LEVEL", "5");
+		assert(5 == env::opt::get(key, 0L));
+		(void) env::var::put("OPT_TEST_LEVEL", "6");
+		assert(6 == env::opt::get(key, 0L));
+		assert(6 == env::opt::get(key, 0.0f));
+	}
+}
+
+test_unit(watch)
+{
+	auto const path = fmt::dir::join({env::temp(), "watch.ini"});
+	auto const key = std::make_pair(fmt::set("Watch"), fmt::set("Key"));
+	{
+		std::ofstream out(path);
+		out << "[Watch]" << fmt::eol << "Key=1" << fmt::eol;
+	}
+	if (env::opt::watch(path))
+	{
+		return; // not supported here
+	}
+	assert(env::opt::get(key, fmt::empty) == "1");
+	{
+		std::ofstream out(path);
+		out << "[Watch]" << fmt::eol << "Key=2" << fmt::eol;
+	}
+	assert(0 < env::opt::reload());
+	assert(env::opt::get(key, fmt::empty) == "2");
+	assert(0 == env::opt::reload());
+	(void) sys::unlink(path.c_str());
 }
 #endif
\ No newline at end of file
@@ -11,6 +11,13 @@
 #include "pipe.hpp"
 #include "sync.hpp"
 #include "type.hpp"
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #ifdef _WIN32
 #include "win/message.hpp"
 #else
@@ -32,26 +39,9 @@ namespace sys
 		true;
 	#endif
 
-	thread_local fmt::string::view thread_id;
-	thread_local fmt::string::stream thread_buf;
-
-	fmt::string::out::ref out()
-	{
-		return thread_buf;
-	}
-
-	fmt::string::out::ref put(fmt::string::out::ref buf)
-	{
-		static sys::mutex key;
-		auto const unlock = key.lock();
+	bool defer = false;
 
-		fmt::string line;
-		while (std::getline(thread_buf, line))
-		{
-			buf << line << std::endl;
-		}
-		return buf;
-	}
+	thread_local fmt::string::view thread_id;
 
 	int impl::bug(fmt::string::view message, bool no)
 	{
@@ -60,33 +50,600 @@ namespace sys
 			fmt::string last;
 			int counter = -1;
 		} local;
+		auto& buf = out();
 		// Avoid spamming
 		if (message != local.last)
 		{
 			// reset
 			local.counter = 0;
-			local.last = fmt::to_string(message);
+			local.last.assign(message);
 			// format
 			{
 				// message
-				thread_buf << local.last;
+				buf << local.last;
 				// number
 				if (no)
 				{
-					thread_buf << ':' << ' ' << std::strerror(errno);
+					buf << ':' << ' ' << std::strerror(errno);
 				}
 				// thread
 				if (not empty(thread_id))
 				{
-					thread_buf << ' ' << '[' << thread_id << ']';
+					buf << ' ' << '[' << thread_id << ']';
 				}
 			}
-			thread_buf << fmt::eol;
+			buf << fmt::eol;
 		}
 		else ++local.counter;
 		return local.counter;
 	}
 
+	namespace
+	{
+		struct ring : fwd::unique
+		// Bytes written by one thread and read by whoever drains
+		{
+			static constexpr size_t size = 1 << 16;
+
+			std::atomic<size_t> head { 0 }; // bytes written
+			std::atomic<size_t> tail { 0 }; // bytes read
+			std::atomic<size_t> lost { 0 }; // records that did not fit
+			std::mutex read; // between readers, or the writer when full
+			fmt::string spill; // read before the ring
+			fmt::string name;
+			char data[size];
+
+			void push(char const* from, size_t n)
+			{
+				auto const begin = head.load(std::memory_order_relaxed);
+				if (size - (begin - tail.load(std::memory_order_acquire)) < n)
+				{
+					// Move unread bytes aside rather than wait for a reader
+					std::lock_guard const lock(read);
+					auto const end = tail.load(std::memory_order_relaxed);
+					auto const k = spill.size();
+					spill.resize(k + begin - end);
+					paste(end, spill.data() + k, begin - end);
+					tail.store(begin, std::memory_order_release);
+					if (size < n)
+					{
+						spill.append(from, n);
+						return;
+					}
+				}
+				copy(begin, from, n);
+				head.store(begin + n, std::memory_order_release);
+			}
+
+			size_t line(size_t begin, size_t end) const
+			// End of the last whole line in the unread bytes
+			{
+				while (begin < end and fmt::eol != data[(end - 1) % size])
+				{
+					--end;
+				}
+				return end;
+			}
+
+			bool empty()
+			{
+				std::lock_guard const lock(read);
+				return head.load() == tail.load() and spill.empty() and 0 == lost.load();
+			}
+
+			void copy(size_t at, void const* from, size_t n)
+			{
+				auto const i = at % size;
+				auto const k = std::min(n, size - i);
+				std::memcpy(data + i, from, k);
+				std::memcpy(data, static_cast<char const*>(from) + k, n - k);
+			}
+
+			void paste(size_t at, void* to, size_t n) const
+			{
+				auto const i = at % size;
+				auto const k = std::min(n, size - i);
+				std::memcpy(to, data + i, k);
+				std::memcpy(static_cast<char*>(to) + k, data, n - k);
+			}
+		};
+
+		struct record
+		{
+			int no;        // errno when made, outside the repeat check
+			unsigned size; // bytes with the fields after
+			unsigned count;
+			bool error;
+			fmt::where at;
+		};
+
+		struct rings
+		{
+			using ptr = std::shared_ptr<ring>;
+			using vector = fwd::vector<ptr>;
+
+			sys::mutex key;
+			vector list; // deferred records
+			vector lines; // bytes of out
+
+			static auto& self()
+			{
+				static rings singleton;
+				return singleton;
+			}
+
+			static ptr make(vector rings::*which)
+			{
+				// Rings outlive their thread so that late bytes still drain
+				auto const that = std::make_shared<ring>();
+				that->name = fmt::to_string(thread_id);
+				auto& all = self();
+				auto const unlock = all.key.lock();
+				(all.*which).push_back(that);
+				return that;
+			}
+
+			static vector copy(vector rings::*which)
+			{
+				auto& all = self();
+				auto const unlock = all.key.lock();
+				auto& rings = all.*which;
+				// Forget rings of ended threads once they are read
+				std::erase_if(rings, [](ptr const& that)
+				{
+					return 1 == that.use_count() and that->empty();
+				});
+				return rings;
+			}
+		};
+
+		ring& local()
+		{
+			thread_local auto const ptr = rings::make(&rings::list);
+			return *ptr;
+		}
+
+		ring& output()
+		{
+			thread_local auto const ptr = rings::make(&rings::lines);
+			return *ptr;
+		}
+
+		struct device : std::streambuf
+		// Stream buffer gathering characters then moving them into the ring of this thread
+		{
+			ring& that = output();
+			char area[256];
+
+			device()
+			{
+				setp(area, area + sizeof area);
+			}
+
+			~device()
+			{
+				(void) sync();
+			}
+
+			int sync() override
+			{
+				if (pbase() < pptr())
+				{
+					that.push(pbase(), fmt::to_size(pptr() - pbase()));
+					setp(area, area + sizeof area);
+				}
+				return 0;
+			}
+
+			int_type overflow(int_type c) override
+			{
+				(void) sync();
+				if (not traits_type::eq_int_type(c, traits_type::eof()))
+				{
+					*pptr() = traits_type::to_char_type(c);
+					pbump(1);
+				}
+				return traits_type::not_eof(c);
+			}
+
+			std::streamsize xsputn(char const* s, std::streamsize n) override
+			{
+				if (epptr() - pptr() < n)
+				{
+					(void) sync();
+					// Pieces larger than the area go straight through
+					if (epptr() - pptr() < n)
+					{
+						that.push(s, fmt::to_size(n));
+						return n;
+					}
+				}
+				std::memcpy(pptr(), s, fmt::to_size(n));
+				pbump(fmt::to_int(n));
+				return n;
+			}
+		};
+
+		struct channel : std::ostream
+		// Hands each insertion to the ring whole so no line waits on a flush
+		{
+			device buf;
+
+			channel() : std::ostream(&buf)
+			{
+				setf(std::ios::unitbuf);
+			}
+		};
+
+		#ifdef _WIN32
+		struct iovec
+		{
+			void* iov_base;
+			size_t iov_len;
+		};
+		#endif
+
+		bool write(int fd, iovec* io, size_t n)
+		{
+			while (0 < n)
+			{
+				#ifdef _WIN32
+				auto const r = sys::write(fd, io->iov_base, fmt::to<unsigned>(io->iov_len));
+				#else
+				// Within the least IOV_MAX of any system
+				auto const r = sys::writev(fd, io, fmt::to_int(std::min<size_t>(n, 16)));
+				#endif
+				if (r < 0)
+				{
+					if (EINTR == errno)
+					{
+						continue;
+					}
+					sys::err(here, "write", fd);
+					return failure;
+				}
+				// Skip what was written, partly of the last piece
+				auto left = fmt::to_size(r);
+				while (0 < n and io->iov_len <= left)
+				{
+					left -= io->iov_len;
+					++io;
+					--n;
+				}
+				if (0 < left)
+				{
+					io->iov_base = static_cast<char*>(io->iov_base) + left;
+					io->iov_len -= left;
+				}
+			}
+			return success;
+		}
+
+		struct flusher
+		{
+			std::mutex key;
+			std::condition_variable wake, done;
+			std::thread worker;
+			std::chrono::milliseconds every;
+			int fd = -1;
+			bool quit = false;
+			size_t asked = 0; // wait tickets
+			size_t served = 0; // tickets written
+
+			static auto& self()
+			{
+				// Rings made first are destroyed after the last pass
+				(void) rings::self();
+				static flusher singleton;
+				return singleton;
+			}
+
+			~flusher()
+			{
+				flush::stop();
+			}
+
+			void run()
+			{
+				std::unique_lock lock(key);
+				while (true)
+				{
+					(void) wake.wait_for(lock, every, [this]
+					{
+						return quit or served < asked;
+					});
+					auto const ticket = asked;
+					bool const last = quit;
+					// Partial lines only when someone is waiting on them
+					bool const all = last or served < ticket;
+					lock.unlock();
+					(void) pass(all);
+					lock.lock();
+					served = ticket;
+					done.notify_all();
+					if (last)
+					{
+						break;
+					}
+				}
+			}
+
+			bool pass(bool all)
+			// One gathered write over every thread, whole lines unless all
+			{
+				fwd::vector<fmt::string> parts;
+				{
+					fmt::string::stream ss;
+					if (0 < impl::drain(ss))
+					{
+						parts.push_back(ss.str());
+					}
+				}
+
+				// Copy out under each lock so a full ring waits on no write
+				for (auto const& that : rings::copy(&rings::lines))
+				{
+					std::lock_guard const lock(that->read);
+					auto const begin = that->tail.load(std::memory_order_relaxed);
+					auto const end = that->head.load(std::memory_order_acquire);
+					auto const stop = all ? end : that->line(begin, end);
+					auto& spill = that->spill;
+					if (all or begin < stop)
+					{
+						parts.emplace_back().swap(spill);
+					}
+					else
+					{
+						// A line the spill cut waits in it for its end
+						auto const k = spill.rfind(fmt::eol) + 1;
+						parts.emplace_back(fmt::string::view(spill).substr(0, k));
+						spill.erase(0, k);
+					}
+					if (begin < stop)
+					{
+						auto& text = parts.emplace_back(stop - begin, '\0');
+						that->paste(begin, text.data(), stop - begin);
+						that->tail.store(stop, std::memory_order_release);
+					}
+				}
+
+				fwd::vector<iovec> io;
+				for (auto& text : parts)
+				{
+					if (not text.empty())
+					{
+						io.push_back({ text.data(), text.size() });
+					}
+				}
+				return io.empty() ? success : write(fd, io.data(), io.size());
+			}
+		};
+	}
+
+	fmt::string::out::ref out()
+	{
+		thread_local channel stream;
+		return stream;
+	}
+
+	fmt::string::out::ref put(fmt::string::out::ref buf)
+	{
+		// Only the ring of this thread, held just for the copy
+		fmt::string text;
+		{
+			auto& that = output();
+			std::lock_guard const lock(that.read);
+			text.swap(that.spill);
+			auto const begin = that.tail.load(std::memory_order_relaxed);
+			auto const end = that.head.load(std::memory_order_acquire);
+			if (begin < end)
+			{
+				auto const k = text.size();
+				text.resize(k + end - begin);
+				that.paste(begin, text.data() + k, end - begin);
+				that.tail.store(end, std::memory_order_release);
+			}
+		}
+
+		// Threads may share a stream that does not lock itself
+		static sys::mutex key;
+		auto const unlock = key.lock();
+		(void) impl::drain(buf);
+		return buf << text << std::flush;
+	}
+
+	bool flush::start(int fd, unsigned ms)
+	{
+		auto& that = flusher::self();
+		std::lock_guard const lock(that.key);
+		if (that.worker.joinable())
+		{
+			return failure;
+		}
+		that.fd = fd;
+		that.quit = false;
+		that.every = std::chrono::milliseconds(ms);
+		that.worker = std::thread(&flusher::run, &that);
+		return success;
+	}
+
+	bool flush::wait(unsigned ms)
+	{
+		auto& that = flusher::self();
+		std::unique_lock lock(that.key);
+		if (not that.worker.joinable())
+		{
+			return failure;
+		}
+		auto const ticket = ++that.asked;
+		that.wake.notify_one();
+		auto const timeout = std::chrono::milliseconds(ms);
+		bool const done = that.done.wait_for(lock, timeout, [&]
+		{
+			return ticket <= that.served;
+		});
+		return done ? success : failure;
+	}
+
+	void flush::stop()
+	{
+		auto& that = flusher::self();
+		{
+			std::lock_guard const lock(that.key);
+			if (not that.worker.joinable())
+			{
+				return;
+			}
+			that.quit = true;
+			that.wake.notify_one();
+		}
+		that.worker.join();
+	}
+
+	int impl::log(fmt::where const& at, bool error, field const* f, size_t n)
+	{
+		thread_local struct
+		{
+			fmt::string buf, last;
+			fmt::where at { };
+			int counter = -1;
+		} local;
+
+		auto const no = errno;
+		auto& buf = local.buf;
+		buf.resize(sizeof (record));
+		for (size_t k = 0; k < n; ++k)
+		{
+			char tag = f[k].tag;
+			switch (tag)
+			{
+			case field::text:
+			case field::owned:
+				{
+					auto const u = field::text == tag ? f[k].s : fmt::string::view(f[k].own);
+					auto const size = fmt::to<unsigned>(u.size());
+					tag = field::text;
+					buf.push_back(tag);
+					buf.append(reinterpret_cast<char const*>(&size), sizeof size);
+					buf.append(u);
+				}
+				break;
+			default:
+				buf.push_back(tag);
+				buf.append(reinterpret_cast<char const*>(&f[k].u), sizeof f[k].u);
+			}
+		}
+
+		record const head { no, fmt::to<unsigned>(buf.size()), fmt::to<unsigned>(n), error, at };
+		std::memcpy(buf.data(), &head, sizeof head);
+
+		// Avoid spamming, without the error number, by call site first
+		bool const same = at.file == local.at.file and at.line == local.at.line and at.func == local.at.func;
+		constexpr auto skip = sizeof head.no;
+		if (same and fmt::string::view(buf).substr(skip) == fmt::string::view(local.last).substr(skip))
+		{
+			return ++local.counter;
+		}
+		local.counter = 0;
+		local.at = at;
+		// Keep this record as the last without a copy
+		std::swap(local.buf, local.last);
+		auto const& bytes = local.last;
+
+		auto& that = sys::local();
+		auto const begin = that.head.load(std::memory_order_relaxed);
+		auto const end = that.tail.load(std::memory_order_acquire);
+		if (ring::size - (begin - end) < bytes.size())
+		{
+			that.lost.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			that.copy(begin, bytes.data(), bytes.size());
+			that.head.store(begin + bytes.size(), std::memory_order_release);
+		}
+		return local.counter;
+	}
+
+	size_t impl::drain(fmt::string::out::ref out)
+	{
+		size_t count = 0;
+		fmt::string text;
+		for (auto const& that : rings::copy(&rings::list))
+		{
+			std::lock_guard const lock(that->read);
+			auto at = that->tail.load(std::memory_order_relaxed);
+			auto const end = that->head.load(std::memory_order_acquire);
+			while (at < end)
+			{
+				record head;
+				that->paste(at, &head, sizeof head);
+				auto pos = at + sizeof head;
+
+				// Same text as the eager format
+				out << head.at.file << "(" << head.at.line << ")" << head.at.func << ":";
+				for (unsigned k = 0; k < head.count; ++k)
+				{
+					char tag;
+					that->paste(pos++, &tag, 1);
+					out << ' ';
+					if (field::text == tag)
+					{
+						unsigned size;
+						that->paste(pos, &size, sizeof size);
+						pos += sizeof size;
+						text.resize(size);
+						that->paste(pos, text.data(), size);
+						pos += size;
+						out << text;
+						continue;
+					}
+
+					field value;
+					that->paste(pos, &value.u, sizeof value.u);
+					pos += sizeof value.u;
+					switch (tag)
+					{
+					case field::sint:
+						out << value.i;
+						break;
+					case field::uint:
+						out << value.u;
+						break;
+					case field::real:
+						out << value.d;
+						break;
+					case field::chr:
+						out << static_cast<char>(value.u);
+						break;
+					case field::addr:
+						out << value.p;
+						break;
+					}
+				}
+				if (head.error)
+				{
+					out << ':' << ' ' << std::strerror(head.no);
+				}
+				if (not that->name.empty())
+				{
+					out << ' ' << '[' << that->name << ']';
+				}
+				out << fmt::eol;
+
+				at += head.size;
+				++count;
+			}
+			that->tail.store(at, std::memory_order_release);
+
+			if (auto const lost = that->lost.exchange(0, std::memory_order_relaxed); 0 < lost)
+			{
+				out << lost << " records lost" << fmt::eol;
+			}
+		}
+		return count;
+	}
+
 	#ifdef _WIN32
 	namespace win
 	{
@@ -673,6 +1230,121 @@ test_unit(sym)
 	assert(f() == hidden());
 }
 
+test_unit(log)
+{
+	int counter[2];
+	sys::defer = true;
+	for (int& n : counter)
+	{
+		n = sys::warn(here, "deferred", 42, 4.5, 'c');
+	}
+	sys::defer = false;
+	assert(0 == counter[0]);
+	assert(1 == counter[1]);
+
+	fmt::string::stream ss;
+	(void) sys::impl::drain(ss);
+	auto const s = ss.str();
+	assert(s.find("deferred 42 4.5 c") != fmt::npos);
+	assert(s.find("deferred", s.find("deferred") + 1) == fmt::npos);
+
+	// Other values from the same site still show, null text as such
+	char const* none = nullptr;
+	sys::defer = true;
+	for (int n = 0; n < 2; ++n)
+	{
+		(void) sys::warn(here, "site", n, none);
+	}
+	sys::defer = false;
+	ss.str("");
+	(void) sys::impl::drain(ss);
+	auto const t = ss.str();
+	assert(t.find("site 0 (null)") != fmt::npos);
+	assert(t.find("site 1 (null)") != fmt::npos);
+}
+
+test_unit(flush)
+{
+	auto const file = std::tmpfile();
+	assert(nullptr != file);
+	auto const fd = sys::fileno(file);
+	assert(success == sys::flush::start(fd, 1));
+	assert(failure == sys::flush::start(fd, 1));
+
+	constexpr int threads = 4, lines = 1000;
+	fwd::vector<std::thread> pool;
+	for (int i = 0; i < threads; ++i)
+	{
+		pool.emplace_back([i]
+		{
+			for (int n = 0; n < lines; ++n)
+			{
+				sys::out() << 'w' << i << ' ' << n << fmt::eol;
+			}
+		});
+	}
+	for (auto& worker : pool)
+	{
+		worker.join();
+	}
+	assert(success == sys::flush::wait());
+	sys::flush::stop();
+	assert(failure == sys::flush::wait());
+
+	// Lines of each thread whole and in order
+	fmt::string text(1 << 16, '\0'), buf;
+	(void) sys::lseek(fd, 0, SEEK_SET);
+	for (sys::ssize_t n; 0 < (n = sys::read(fd, text.data(), fmt::to<unsigned>(text.size())));)
+	{
+		buf.append(text.data(), fmt::to_size(n));
+	}
+	(void) std::fclose(file);
+
+	int next[threads] = { };
+	fmt::string::stream ss(buf);
+	for (fmt::string line; std::getline(ss, line);)
+	{
+		int i = -1, n = -1;
+		assert(2 == std::sscanf(line.c_str(), "w%d %d", &i, &n));
+		assert(0 <= i and i < threads);
+		if (0 <= i and i < threads)
+		{
+			assert(next[i] == n);
+			next[i] = n + 1;
+		}
+	}
+	for (int n : next)
+	{
+		assert(lines == n);
+	}
+
+	// Threads putting into one plain stream keep their lines whole
+	fmt::string::stream shared;
+	pool.clear();
+	for (int i = 0; i < threads; ++i)
+	{
+		pool.emplace_back([i, &shared]
+		{
+			for (int n = 0; n < 100; ++n)
+			{
+				sys::out() << 'p' << i << ' ' << n << fmt::eol;
+				(void) sys::put(shared);
+			}
+		});
+	}
+	for (auto& worker : pool)
+	{
+		worker.join();
+	}
+	int count = 0;
+	for (fmt::string line; std::getline(shared, line); ++count)
+	{
+		int i = -1, n = -1;
+		assert(2 == std::sscanf(line.c_str(), "p%d %d", &i, &n));
+	}
+	assert(threads * 100 == count);
+}
+
 test_unit(sig)
 {
 	std::vector<int> caught;
@@ -699,4 +1371,117 @@ test_unit(sig)
 	}
 }
 
+test_unit(raise)
+{
+	// Small callables stay in place, large ones go to the heap
+	using function = fwd::sig::callable<int(int)>;
+	function small = [](int n) { return n + 1; };
+	std::array<int, 64> big { };
+	big.fill(2);
+	function large = [big](int n) { return n + big.back(); };
+	auto copy = large;
+	function moved = std::move(small);
+	assert(not small and moved and 2 == moved(1));
+	assert(3 == copy(1) and 3 == large(1));
+	copy = moved;
+	assert(5 == copy(4));
+
+	// Hundreds of listeners in slot order
+	fwd::sig::socket<int, int> socket;
+	std::atomic<int> sum = 0;
+	for (int id = 0; id < 300; ++id)
+	{
+		socket.connect(id, [&sum, id](int n) { sum += id * n; });
+	}
+	assert(300 == socket.connect(7, [](int) { }));
+	assert(300 == socket.size() and 7 == socket.find(7));
+	socket.raise(2);
+	assert(299 * 300 == sum);
+	assert(1 == socket.disconnect(7) and 0 == socket.disconnect(7));
+	assert(socket.invalid == socket.find(7) and 7 == socket.find(8));
+
+	// Changes made while raising take effect on the next raise
+	int calls = 0;
+	fwd::sig::socket<int> self;
+	self.connect(1, [&]
+	{
+		++calls;
+		self.disconnect(1);
+		self.connect(2, [&] { calls += 10; });
+	});
+	self.raise();
+	assert(1 == calls);
+	self.raise();
+	assert(11 == calls and 1 == self.size());
+
+	// A raise pins only its own array, so replaced ones are freed under it
+	struct tracker
+	{
+		int* live;
+		tracker(int* n) : live(n) { ++*live; }
+		tracker(tracker const& that) : live(that.live) { ++*live; }
+		~tracker() { --*live; }
+	};
+	int live = 0;
+	self.connect(3, [&]
+	{
+		for (int n = 0; n < 1000; ++n)
+		{
+			self.connect(4, [hold = tracker(&live)] { });
+			(void) self.disconnect(4);
+		}
+		assert(0 == live);
+	});
+	self.raise(3, [](auto const& pair) { pair.second(); });
+
+	// A listener may disconnect from its own socket as it is destroyed
+	struct leaver
+	{
+		fwd::sig::socket<int>* from;
+		leaver(fwd::sig::socket<int>* s) : from(s) { }
+		leaver(leaver const&) = default;
+		leaver(leaver&& that) noexcept : from(std::exchange(that.from, nullptr)) { }
+		~leaver() { if (from) (void) from->disconnect(3); }
+	};
+	self.connect(5, [hold = leaver(&self)] { });
+	assert(1 == self.disconnect(5));
+	assert(self.invalid == self.find(3));
+
+	// Raise from some threads while others connect and disconnect
+	std::atomic<bool> done = false;
+	fwd::vector<std::thread> pool;
+	for (int t = 0; t < 2; ++t)
+	{
+		pool.emplace_back([&]
+		{
+			while (not done)
+			{
+				socket.raise(1);
+			}
+		});
+	}
+	for (int t = 0; t < 2; ++t)
+	{
+		pool.emplace_back([&socket, t]
+		{
+			for (int n = 0; n < 1000; ++n)
+			{
+				auto const id = 1000 + 2 * n + t;
+				socket.connect(id, [](int) { });
+				(void) socket.disconnect(id);
+			}
+		});
+	}
+	for (auto n = pool.size(); n > 2; --n)
+	{
+		pool[n - 1].join();
+	}
+	done = true;
+	pool[0].join();
+	pool[1].join();
+	assert(299 == socket.size());
+	assert(299 == socket.disconnect());
+	assert(0 == socket.size());
+}
+
 #endif